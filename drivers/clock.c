@@ -28,7 +28,7 @@
 // Subroutines
 //-----------------------------------------------------------------------------
 
-uint32_t systime = 0;
+volatile uint32_t systime = 0;   // ms, counted by sysTickIsr
 
 // Initialize system clock to 40 MHz using PLL and 16 MHz crystal oscillator
 void initSystemClockTo40Mhz(void) {
@@ -42,6 +42,17 @@ void initSysTimer1ms() {
     NVIC_ST_CTRL_R |= NVIC_ST_CTRL_INTEN | NVIC_ST_CTRL_CLK_SRC | NVIC_ST_CTRL_ENABLE; //set clk src to sysclk, enable systick
 }
 
+// Starts the DWT cycle counter (40 cycles per us, wraps every 107 s)
+void initCycleCounter() {
+    NVIC_DBG_INT_R |= DEMCR_TRCENA;
+    DWT_CYCCNT_R = 0;
+    DWT_CTRL_R |= DWT_CTRL_CYCCNTENA;
+}
+
+uint32_t getCycleCount() {
+    return DWT_CYCCNT_R;
+}
+
 uint32_t millis() {
     return systime;
 }
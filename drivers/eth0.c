@@ -28,6 +28,7 @@
 #include "wait.h"
 #include "gpio.h"
 #include "spi0.h"
+#include "clock.h"
 #include "eth0.h"
 
 // Pins
@@ -53,7 +54,16 @@
 #define ERXRDPTH    0x0D
 #define ERXWRPTL    0x0E
 #define ERXWRPTH    0x0F
+#define EDMASTL     0x10
+#define EDMASTH     0x11
+#define EDMANDL     0x12
+#define EDMANDH     0x13
+#define EDMACSL     0x16
+#define EDMACSH     0x17
 #define EIE         0x1B
+#define RXERIE  0x01
+#define PKTIE   0x40
+#define INTIE   0x80
 #define EIR         0x1C
 #define RXERIF  0x01
 #define TXERIF  0x02
@@ -66,7 +76,17 @@
 #define PKTDEC  0x40
 #define ECON1       0x1F
 #define RXEN    0x04
+#define RXRST   0x40
 #define TXRTS   0x08
+#define CSUMEN  0x10
+#define DMAST   0x20
+#define TXRST   0x80
+#define EHT0        0x20
+#define EPMM0       0x28
+#define EPMCSL      0x30
+#define EPMCSH      0x31
+#define EPMOL       0x34
+#define EPMOH       0x35
 #define ERXFCON     0x38
 #define EPKTCNT     0x39
 #define MACON1      0x40
@@ -104,8 +124,20 @@
 #define MISTAT      0x6A
 #define MIBUSY  0x01
 #define ECOCON      0x75
+#define EFLOCON     0x77
+#define FCOFF   0x00
+#define FCHALF  0x01    // half duplex backpressure
+#define FCPAUSE 0x02    // full duplex pause frames, repeated until turned off
+#define FCZERO  0x03    // full duplex, one zero timer pause frame then off
+#define EPAUSL      0x78
+#define EPAUSH      0x79
 #define MCASTCTRL  0x400
 
+// Buffer memory layout
+#define ETHER_MEM_SIZE      0x2000
+#define ETHER_MAX_RX_SIZE   1522            // largest byte count in a receive status vector
+#define ETHER_TX_SLOT_SIZE  0x05F6          // control byte + 1518 byte frame + 7 byte status vector
+
 // Ether phy registers
 #define PHCON1      0x00
 #define PDPXMD 0x0100
@@ -124,9 +156,41 @@ const uint8_t BROADCAST_MAC_ADDRESS[HW_ADD_LENGTH] = {0xFF,0xFF,0xFF,0xFF,0xFF,0
 
 uint8_t nextPacketLsb = 0x00;
 uint8_t nextPacketMsb = 0x00;
+uint16_t rxSize = 0;        // size of frame being read
+uint16_t rxRead = 0;        // bytes of it already read
 uint8_t sequenceId = 1;
 uint8_t hwAddress[HW_ADD_LENGTH] = {2,3,4,5,6,7};
 
+// Transmit slots are filled in ring order, a slot is only rewritten once the
+// frame in it has left the queue
+// The queue holds slot numbers, the oldest one is the one on the wire
+uint8_t txSlots = 1;
+uint8_t txNext = 0;
+uint8_t txQueue[ETHER_MAX_TX_SLOTS];
+uint8_t txHead = 0;
+uint8_t txCount = 0;
+uint8_t txRefs[ETHER_MAX_TX_SLOTS];     // times each slot is queued or on the wire
+uint16_t txSize[ETHER_MAX_TX_SLOTS];    // size of frame in each slot
+bool txSending = false;
+bool txAsync = false;
+bool txLastOk = true;
+uint16_t rxEnd = 0x1A09;
+bool fullDuplex = false;
+bool flowControl = false;
+bool flowControlOn = false;
+bool csumOffload = false;
+uint16_t rxFrameStart = 0;  // buffer address of frame being read (after rx header)
+
+// Receive events pushed by etherIsr() and popped by the main loop
+// Single producer (isr) and single consumer (main), so no locking is needed
+volatile uint32_t rxEvents[ETHER_RX_EVENT_QUEUE_SIZE];   // getCycleCount() at interrupt
+volatile uint8_t rxEventHead = 0;                         // written by isr only
+volatile uint8_t rxEventTail = 0;                         // written by main only
+volatile uint32_t rxEventDrops = 0;
+uint32_t rxEventTime = 0;                                 // oldest event of the last pop
+bool rxEventTimeValid = false;
+etherStats stats;
+
 // ------------------------------------------------------------------------------
 //  Structures
 // ------------------------------------------------------------------------------
@@ -138,6 +202,14 @@ uint8_t hwAddress[HW_ADD_LENGTH] = {2,3,4,5,6,7};
 // Buffer is configured as follows
 // Receive buffer starts at 0x0000 (bottom 6666 bytes of 8K space)
 // Transmit buffer at 01A0A (top 1526 bytes of 8K space)
+// With more transmit slots (ETHER_TX_SLOTS, or two by default in async tx
+// mode) they are stacked 1526 bytes apart at the top of the 8K space and the
+// receive buffer shrinks to make room for them, down to 2088 bytes for 4 slots
+
+uint16_t getEtherTxSlotAddress(uint8_t slot)
+{
+    return ETHER_MEM_SIZE - (txSlots - slot) * ETHER_TX_SLOT_SIZE;
+}
 
 void enableEtherCs(void)
 {
@@ -236,6 +308,11 @@ void writeEtherMem(uint8_t data)
     readSpi0Data();
 }
 
+void writeEtherMemBlock(const uint8_t data[], uint16_t size)
+{
+    writeSpi0Block(data, size);
+}
+
 void stopEtherMemWrite(void)
 {
     disableEtherCs();
@@ -254,11 +331,38 @@ uint8_t readEtherMem(void)
     return readSpi0Data();
 }
 
+void readEtherMemBlock(uint8_t data[], uint16_t size)
+{
+    readSpi0Block(data, size);
+}
+
 void stopEtherMemRead(void)
 {
     disableEtherCs();
 }
 
+// Sets up receive buffer pointers, rx must be disabled
+void initEtherRxBuffer(void)
+{
+    // initialize receive buffer space
+    setEtherBank(ERXSTL);
+    writeEtherReg(ERXSTL, LOBYTE(0x0000));
+    writeEtherReg(ERXSTH, HIBYTE(0x0000));
+    writeEtherReg(ERXNDL, LOBYTE(rxEnd));
+    writeEtherReg(ERXNDH, HIBYTE(rxEnd));
+
+    // initialize receiver write and read ptrs
+    // at startup, will write from 0 to rxEnd-1 only and will not overwrite rd ptr
+    writeEtherReg(ERXWRPTL, LOBYTE(0x0000));
+    writeEtherReg(ERXWRPTH, HIBYTE(0x0000));
+    writeEtherReg(ERXRDPTL, LOBYTE(rxEnd));
+    writeEtherReg(ERXRDPTH, HIBYTE(rxEnd));
+    writeEtherReg(ERDPTL, LOBYTE(0x0000));
+    writeEtherReg(ERDPTH, HIBYTE(0x0000));
+    nextPacketLsb = 0;
+    nextPacketMsb = 0;
+}
+
 void resetEther() {
     setPinValue(RESET, 0);
     waitMicrosecond(1500);
@@ -271,9 +375,11 @@ void resetEther() {
 // Uses order suggested in Chapter 6 of datasheet except 6.4 OST which is first here
 void initEther(uint16_t mode)
 {
+    uint8_t i;
+
     // Initialize SPI0
     initSpi0(USE_SSI0_RX);
-    setSpi0BaudRate(10e6, 40e6);
+    setSpi0BaudRate(20e6, 40e6);
     setSpi0Mode(0, 0);
 
     // Enable clocks
@@ -293,21 +399,26 @@ void initEther(uint16_t mode)
     clearEtherReg(ECON1, RXEN);
     clearEtherReg(ECON1, TXRTS);
 
-    // initialize receive buffer space
-    setEtherBank(ERXSTL);
-    writeEtherReg(ERXSTL, LOBYTE(0x0000));
-    writeEtherReg(ERXSTH, HIBYTE(0x0000));
-    writeEtherReg(ERXNDL, LOBYTE(0x1A09));
-    writeEtherReg(ERXNDH, HIBYTE(0x1A09));
-   
-    // initialize receiver write and read ptrs
-    // at startup, will write from 0 to 1A08 only and will not overwrite rd ptr
-    writeEtherReg(ERXWRPTL, LOBYTE(0x0000));
-    writeEtherReg(ERXWRPTH, HIBYTE(0x0000));
-    writeEtherReg(ERXRDPTL, LOBYTE(0x1A09));
-    writeEtherReg(ERXRDPTH, HIBYTE(0x1A09));
-    writeEtherReg(ERDPTL, LOBYTE(0x0000));
-    writeEtherReg(ERDPTH, HIBYTE(0x0000));
+    // set up transmit slots, receive buffer ends just below the first one
+    txAsync = (mode & ETHER_ASYNC_TX) != 0;
+    txSlots = (mode & ETHER_TX_SLOTS_MASK) >> ETHER_TX_SLOTS_SHIFT;
+    if (txSlots == 0)
+        txSlots = txAsync ? 2 : 1;
+    if (txSlots > ETHER_MAX_TX_SLOTS)
+        txSlots = ETHER_MAX_TX_SLOTS;
+    for (i = 0; i < ETHER_MAX_TX_SLOTS; i++)
+    {
+        txRefs[i] = 0;
+        txSize[i] = 0;
+    }
+    txNext = 0;
+    txHead = 0;
+    txCount = 0;
+    txSending = false;
+    txLastOk = true;
+    rxEnd = getEtherTxSlotAddress(0) - 1;
+
+    initEtherRxBuffer();
 
     // setup receive filter
     // always check CRC, use OR mode
@@ -320,6 +431,14 @@ void initEther(uint16_t mode)
   
     // enable mac rx, enable pause control for full duplex
     writeEtherReg(MACON1, TXPAUS | RXPAUS | MARXEN);
+    fullDuplex = (mode & ETHER_FULLDUPLEX) != 0;
+    flowControl = (mode & ETHER_FLOWCONTROL) != 0;
+    flowControlOn = false;
+#ifdef ETHER_CSUM_OFFLOAD_ENABLED
+    csumOffload = (mode & ETHER_CSUM_OFFLOAD) != 0;
+#else
+    csumOffload = false;    // EDMACS byte order only checked against the host model so far
+#endif
 
     // enable padding to 60 bytes (no runt packets)
     // add crc to tx packets, set full or half duplex
@@ -346,6 +465,12 @@ void initEther(uint16_t mode)
 
     // leave collision window MACLCON2 as reset
 
+    // pause timer for flow control, in units of 512 bit times
+    setEtherBank(EPAUSL);
+    writeEtherReg(EPAUSL, LOBYTE(0x1000));
+    writeEtherReg(EPAUSH, HIBYTE(0x1000));
+    writeEtherReg(EFLOCON, FCOFF);
+
     // initialize phy duplex
     if ((mode & ETHER_FULLDUPLEX) != 0)
         writeEtherPhy(PHCON1, PDPXMD);
@@ -363,10 +488,97 @@ void initEther(uint16_t mode)
     // stretch LED on to 40ms (default)
     writeEtherPhy(PHLCON, 0x0472);
 
+    // assert INT on received packets and rx errors
+    // (tx flags stay masked, TXIF remains set between frames and would hold INT low)
+    writeEtherReg(EIE, INTIE | PKTIE | RXERIE);
+    rxEventHead = rxEventTail = 0;
+    selectPinInterruptFallingEdge(INT);
+    clearPinInterrupt(INT);
+    enablePinInterrupt(INT);
+    NVIC_EN0_R |= 1 << (INT_GPIOC-16);                // turn-on interrupt 2 (vector 18, GPIOC)
+
     // enable reception
     setEtherReg(ECON1, RXEN);
 }
 
+// Sets which frames the controller accepts (ETHER_UNICAST, ETHER_BROADCAST,
+// ETHER_HASHTABLE, ETHER_PATTERNMATCH, ...), CRC is always checked
+// Frames that pass any enabled filter are kept (OR mode)
+void setEtherReceiveFilter(uint8_t filter)
+{
+    setEtherBank(ERXFCON);
+    writeEtherReg(ERXFCON, filter | ETHER_CHECKCRC);
+}
+
+// Programs the pattern match filter (ETHER_PATTERNMATCH)
+// window holds the 64 frame bytes starting at offset, mask has a bit set for
+// each byte of the window that must match (bit 0 of mask[0] is window[0])
+void setEtherPatternMatch(uint16_t offset, const uint8_t window[ETHER_PATTERN_SIZE], const uint8_t mask[ETHER_PATTERN_SIZE / 8])
+{
+    uint32_t sum = 0;
+    uint16_t csum;
+    uint8_t i;
+    bool high = true;
+
+    // controller compares the ip checksum of the selected bytes
+    for (i = 0; i < ETHER_PATTERN_SIZE; i++)
+    {
+        if (mask[i / 8] & (1 << (i % 8)))
+        {
+            sum += high ? (window[i] << 8) : window[i];
+            high = !high;
+        }
+    }
+    while ((sum >> 16) > 0)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    csum = ~sum;
+
+    setEtherBank(EPMM0);
+    for (i = 0; i < ETHER_PATTERN_SIZE / 8; i++)
+        writeEtherReg(EPMM0 + i, mask[i]);
+    writeEtherReg(EPMCSL, LOBYTE(csum));
+    writeEtherReg(EPMCSH, HIBYTE(csum));
+    writeEtherReg(EPMOL, LOBYTE(offset));
+    writeEtherReg(EPMOH, HIBYTE(offset));
+}
+
+// Returns the bit in the multicast hash table a destination address maps to
+// (bits 28:23 of the ethernet crc of the address)
+uint8_t getEtherHashIndex(const uint8_t mac[HW_ADD_LENGTH])
+{
+    uint32_t crc = 0xFFFFFFFF;
+    uint8_t i, j, data;
+    for (i = 0; i < HW_ADD_LENGTH; i++)
+    {
+        data = mac[i];
+        for (j = 0; j < 8; j++)
+        {
+            if (((crc >> 31) ^ data) & 1)
+                crc = (crc << 1) ^ 0x04C11DB7;
+            else
+                crc <<= 1;
+            data >>= 1;
+        }
+    }
+    return (crc >> 23) & 0x3F;
+}
+
+// Programs the multicast hash table (ETHER_HASHTABLE) to accept the given
+// group addresses (and whatever else hashes to the same bits)
+void setEtherMulticastHash(const uint8_t macs[][HW_ADD_LENGTH], uint8_t count)
+{
+    uint8_t table[8] = {0,0,0,0,0,0,0,0};
+    uint8_t i, index;
+    for (i = 0; i < count; i++)
+    {
+        index = getEtherHashIndex(macs[i]);
+        table[index / 8] |= 1 << (index % 8);
+    }
+    setEtherBank(EHT0);
+    for (i = 0; i < 8; i++)
+        writeEtherReg(EHT0 + i, table[i]);
+}
+
 // Returns true if link is up
 bool isEtherLinkUp(void)
 {
@@ -385,76 +597,372 @@ bool isEtherOverflow(void)
     bool err;
     err = (readEtherReg(EIR) & RXERIF) != 0;
     if (err)
+    {
         clearEtherReg(EIR, RXERIF);
+        stats.rxOverflows++;
+    }
     return err;
 }
 
-// Returns up to max_size characters in data buffer
-// Returns number of bytes copied to buffer
-// Contents written are 16-bit size, 16-bit status, payload excl crc
-uint16_t getEtherPacket(etherHeader *ether, uint16_t maxSize)
+// Handles the falling edge of the ENC28J60 INT line
+// SPI may be in use by the main loop, so the isr only queues the event
+void etherIsr(void)
 {
-    uint16_t i = 0, size, tmp16, status;
-    uint8_t *packet = (uint8_t*)ether;
+    uint8_t next = (rxEventHead + 1) & (ETHER_RX_EVENT_QUEUE_SIZE - 1);
+    clearPinInterrupt(INT);
+    if (next == rxEventTail)
+    {
+        rxEventDrops++;
+        return;
+    }
+    rxEvents[rxEventHead] = getCycleCount();
+    rxEventHead = next;
+}
 
-    // enable read from FIFO buffers
-    startEtherMemRead();
+// Returns true if the controller has signaled that packets are waiting
+// Pops all queued interrupt events, INT is also checked since it stays low
+// (no new edge) while packets are left unread in the rx buffer
+bool isEtherRxPending(void)
+{
+    bool pending = false;
+    while (rxEventTail != rxEventHead)
+    {
+        if (!pending)
+            rxEventTime = rxEvents[rxEventTail];
+        rxEventTail = (rxEventTail + 1) & (ETHER_RX_EVENT_QUEUE_SIZE - 1);
+        stats.rxEvents++;
+        pending = true;
+    }
+    rxEventTimeValid = pending;
+    return pending || !getPinValue(INT);
+}
 
-    // get next packet information
-    nextPacketLsb = readEtherMem();
-    nextPacketMsb = readEtherMem();
+// Gets the time (cycle count) of the oldest receive interrupt popped by the
+// last isEtherRxPending() call, so the main loop can tell how long frames
+// waited. Returns false if that call popped none (frames left from before)
+bool getEtherRxEventTime(uint32_t* cycles)
+{
+    if (rxEventTimeValid)
+        *cycles = rxEventTime;
+    return rxEventTimeValid;
+}
 
-    // calc size
-    // don't return crc, instead return size + status, so size is correct
-    size = readEtherMem();
-    tmp16 = readEtherMem();
-    size |= (tmp16 << 8);
+// Returns number of bytes waiting in the rx buffer
+uint16_t getEtherRxUsed(void)
+{
+    uint16_t wr, rd;
+    setEtherBank(ERXWRPTL);
+    wr = readEtherReg(ERXWRPTL);
+    wr |= readEtherReg(ERXWRPTH) << 8;
+    rd = nextPacketLsb | (nextPacketMsb << 8);
+    return (wr >= rd) ? wr - rd : wr + rxEnd + 1 - rd;
+}
 
-    // get status (currently unused)
-    status = readEtherMem();
-    tmp16 = readEtherMem();
-    status |= (tmp16 << 8);
+// Asks the link partner to stop sending while the rx buffer is above 3/4
+// full (pause frames in full duplex, backpressure in half duplex) and lets
+// it resume once the buffer drains below 1/4
+void updateEtherFlowControl(void)
+{
+    uint16_t used = getEtherRxUsed();
+    if (!flowControlOn && used > ((rxEnd + 1) / 4) * 3)
+    {
+        setEtherBank(EFLOCON);
+        writeEtherReg(EFLOCON, fullDuplex ? FCPAUSE : FCHALF);
+        flowControlOn = true;
+        stats.flowControlEvents++;
+    }
+    else if (flowControlOn && used < (rxEnd + 1) / 4)
+    {
+        setEtherBank(EFLOCON);
+        writeEtherReg(EFLOCON, fullDuplex ? FCZERO : FCOFF);
+        flowControlOn = false;
+    }
+}
 
-    // copy data
-    if (size > maxSize)
-        size = maxSize;
-    while (i < size)
-        packet[i++] = readEtherMem();
+// Returns number of packets waiting in the rx buffer
+// PKTIF is unreliable (errata), so EPKTCNT is read instead
+uint8_t getEtherPacketCount(void)
+{
+    uint8_t count;
+    setEtherBank(EPKTCNT);
+    count = readEtherReg(EPKTCNT);
+    if (count > stats.rxPacketsHighWater)
+        stats.rxPacketsHighWater = count;
+    if (flowControl)
+        updateEtherFlowControl();
+    return count;
+}
 
-    // end read from FIFO buffers
-    stopEtherMemRead();
+// Throws away everything in the rx buffer and restarts reception
+// Used when the buffer pointers can no longer be trusted
+void resetEtherRx(void)
+{
+    uint8_t count;
+    clearEtherReg(ECON1, RXEN);
+    setEtherReg(ECON1, RXRST);
+    clearEtherReg(ECON1, RXRST);
+    setEtherBank(EPKTCNT);
+    count = readEtherReg(EPKTCNT);
+    stats.rxDrops += count;
+    while (count--)
+        setEtherReg(ECON2, PKTDEC);
+    initEtherRxBuffer();
+    clearEtherReg(EIR, RXERIF);
+    setEtherReg(ECON1, RXEN);
+    stats.rxResets++;
+}
+
+// Gets driver counters
+void getEtherStats(etherStats* s)
+{
+    *s = stats;
+    s->rxEventDrops = rxEventDrops;
+}
+
+// Frees the current frame in the rx buffer and moves to the next one
+void advanceEtherRxPtr(void)
+{
+    uint16_t next, rdpt;
 
     // advance read pointer
+    // ERXRDPT must be odd (errata), so free up to the byte before the next packet
+    next = nextPacketLsb | (nextPacketMsb << 8);
+    rdpt = (next == 0) ? rxEnd : next - 1;
     setEtherBank(ERXRDPTL);
-    writeEtherReg(ERXRDPTL, nextPacketLsb); // hw ptr
-    writeEtherReg(ERXRDPTH, nextPacketMsb);
+    writeEtherReg(ERXRDPTL, LOBYTE(rdpt));  // hw ptr
+    writeEtherReg(ERXRDPTH, HIBYTE(rdpt));
     writeEtherReg(ERDPTL, nextPacketLsb);   // dma rd ptr
     writeEtherReg(ERDPTH, nextPacketMsb);
 
     // decrement packet counter so that PKTIF is maintained correctly
     setEtherReg(ECON2, PKTDEC);
+}
+
+// Reads the receive header and up to peekSize bytes from the start of the
+// next frame, leaving the rest in the rx buffer
+// Must be followed by finishEtherPacket() or discardEtherPacket()
+// Returns size of the whole frame, or 0 if the rx buffer had to be reset
+uint16_t peekEtherPacket(etherHeader *ether, uint16_t peekSize)
+{
+    uint16_t size, status, next;
+    uint8_t header[6];
+
+    // frame follows the 6 byte rx header
+    rxFrameStart = (nextPacketLsb | (nextPacketMsb << 8)) + 6;
+    if (rxFrameStart > rxEnd)
+        rxFrameStart -= rxEnd + 1;
+
+    // enable read from FIFO buffers
+    startEtherMemRead();
+
+    // get next packet pointer, size and status (status currently unused)
+    // don't return crc, instead return size + status, so size is correct
+    readEtherMemBlock(header, sizeof(header));
+    nextPacketLsb = header[0];
+    nextPacketMsb = header[1];
+    size = header[2] | (header[3] << 8);
+    status = header[4] | (header[5] << 8);
+    (void)status;
+
+    // a bad next packet pointer or size means the rx buffer is corrupt
+    next = nextPacketLsb | (nextPacketMsb << 8);
+    if ((next & 1) || (next > rxEnd) || (size > ETHER_MAX_RX_SIZE))
+    {
+        stopEtherMemRead();
+        resetEtherRx();
+        return 0;
+    }
+
+    // copy start of frame
+    rxSize = size;
+    rxRead = (size > peekSize) ? peekSize : size;
+    readEtherMemBlock((uint8_t*)ether, rxRead);
+
+    // end read from FIFO buffers
+    // ERDPT keeps its place for finishEtherPacket()
+    stopEtherMemRead();
 
     return size;
 }
 
-// Writes a packet
-bool putEtherPacket(etherHeader *ether, uint16_t size)
+// Copies the rest of a peeked frame (up to maxSize bytes in total) and
+// frees it in the rx buffer
+// Returns number of bytes in buffer
+uint16_t finishEtherPacket(etherHeader *ether, uint16_t maxSize)
+{
+    uint16_t size = (rxSize > maxSize) ? maxSize : rxSize;
+    if (size > rxRead)
+    {
+        startEtherMemRead();
+        readEtherMemBlock((uint8_t*)ether + rxRead, size - rxRead);
+        stopEtherMemRead();
+    }
+    advanceEtherRxPtr();
+    return size;
+}
+
+// Frees a peeked frame without reading the rest of it over SPI
+void discardEtherPacket(void)
+{
+    advanceEtherRxPtr();
+}
+
+// Returns up to max_size characters in data buffer
+// Returns number of bytes copied to buffer
+// Contents written are 16-bit size, 16-bit status, payload excl crc
+uint16_t getEtherPacket(etherHeader *ether, uint16_t maxSize)
+{
+    if (peekEtherPacket(ether, maxSize) == 0)
+        return 0;
+    return finishEtherPacket(ether, maxSize);
+}
+
+// Starts transmission of the oldest queued slot if the transmitter is idle
+void startEtherTx(void)
 {
-    uint16_t i;
-    uint8_t *packet = (uint8_t*) ether;
+    uint8_t slot;
+    uint16_t start, end;
+    if (txSending || txCount == 0)
+        return;
+    slot = txQueue[txHead];
+    start = getEtherTxSlotAddress(slot);
+    end = start + txSize[slot];
+    setEtherBank(ETXSTL);
+    writeEtherReg(ETXSTL, LOBYTE(start));
+    writeEtherReg(ETXSTH, HIBYTE(start));
+    writeEtherReg(ETXNDL, LOBYTE(end));
+    writeEtherReg(ETXNDH, HIBYTE(end));
+    clearEtherReg(EIR, TXIF | TXERIF);
+    setEtherReg(ECON1, TXRTS);
+    txSending = true;
+}
+
+// Adds a written slot to the transmit queue and starts it if idle
+// In blocking mode, waits for the queue to drain and returns the result
+bool queueEtherTx(uint8_t slot)
+{
+    // wait for room in the queue
+    while (txCount == txSlots)
+        pollEtherTx();
+    txQueue[(txHead + txCount) % txSlots] = slot;
+    txCount++;
+    txRefs[slot]++;
+    startEtherTx();
+    if (txAsync)
+        return true;
+
+    // wait for completion
+    while (txCount != 0)
+        pollEtherTx();
+
+    // determine success
+    return txLastOk;
+}
 
-    // clear out any tx errors
-    if ((readEtherReg(EIR) & TXERIF) != 0)
+// Checks for completion of the frame on the wire and starts the next queued
+// frame
+// Completion is polled rather than taken from TXIF: the flag stays set until
+// the next frame is started, so enabling it would hold INT low between frames
+// and bury the rx events etherIsr() timestamps. Must be called periodically
+// in async tx mode, the netif layer does it from runNetworkTx() and keeps the
+// scheduler awake while isEtherTxBusy()
+void pollEtherTx(void)
+{
+    uint8_t eir, slot;
+    if (!txSending)
+        return;
+    if ((readEtherReg(ECON1) & TXRTS) != 0)
+        return;
+    eir = readEtherReg(EIR);
+    txLastOk = ((readEtherReg(ESTAT) & TXABORT) == 0) && ((eir & TXERIF) == 0);
+    // transmit logic can stall after an error (errata), reset it
+    if ((eir & TXERIF) != 0)
     {
+        setEtherReg(ECON1, TXRST);
+        clearEtherReg(ECON1, TXRST);
         clearEtherReg(EIR, TXERIF);
-        setEtherReg(ECON1, TXRTS);
-        clearEtherReg(ECON1, TXRTS);
     }
+    slot = txQueue[txHead];
+    txSending = false;
+    txHead = (txHead + 1) % txSlots;
+    txCount--;
+    txRefs[slot]--;
+    startEtherTx();
+}
+
+// Returns true if frames are queued or on the wire
+bool isEtherTxBusy(void)
+{
+    return txCount != 0;
+}
+
+// Returns true if checksums may be computed by the controller (ETHER_CSUM_OFFLOAD,
+// only honored when built with ETHER_CSUM_OFFLOAD_ENABLED)
+bool isEtherChecksumOffload(void)
+{
+    return csumOffload;
+}
+
+// Runs the DMA checksum engine over buffer memory from start to end (inclusive)
+// A range in the rx buffer may wrap past ERXND
+// Returns the complemented checksum with the first byte on the wire in the
+// low byte, so it can be stored in a frame as is
+uint16_t sumEtherMem(uint16_t start, uint16_t end)
+{
+    uint16_t csum;
+    setEtherBank(EDMASTL);
+    writeEtherReg(EDMASTL, LOBYTE(start));
+    writeEtherReg(EDMASTH, HIBYTE(start));
+    writeEtherReg(EDMANDL, LOBYTE(end));
+    writeEtherReg(EDMANDH, HIBYTE(end));
+    setEtherReg(ECON1, CSUMEN);
+    setEtherReg(ECON1, DMAST);
+    while ((readEtherReg(ECON1) & DMAST) != 0);
+    clearEtherReg(ECON1, CSUMEN);
+    // EDMACSH holds the byte that goes first on the wire (Microchip's driver
+    // reads it the same way), see tools/eth0_model_test.c
+    csum = readEtherReg(EDMACSH);
+    csum |= readEtherReg(EDMACSL) << 8;
+    return csum;
+}
+
+// Computes the checksum of size bytes at offset in the frame being read,
+// before it is copied
+// Must be called between peekEtherPacket() and finishEtherPacket()
+// Returns false if offload is disabled or the range is outside the frame
+bool getEtherRxChecksum(uint16_t offset, uint16_t size, uint16_t* csum)
+{
+    uint16_t start, end;
+    if (!csumOffload || size == 0 || offset + size > rxSize)
+        return false;
+    start = rxFrameStart + offset;
+    if (start > rxEnd)
+        start -= rxEnd + 1;
+    end = start + size - 1;
+    if (end > rxEnd)
+        end -= rxEnd + 1;
+    *csum = sumEtherMem(start, end);
+    return true;
+}
+
+// Copies a frame to the next free transmit slot
+// Returns slot
+uint8_t writeEtherTxSlot(etherHeader *ether, uint16_t size)
+{
+    uint8_t slot;
+    uint16_t start;
+
+    // wait for the next slot to be free
+    slot = txNext;
+    while (txRefs[slot] != 0)
+        pollEtherTx();
+    txNext = (txNext + 1) % txSlots;
+    start = getEtherTxSlotAddress(slot);
 
     // set DMA start address
     setEtherBank(EWRPTL);
-    writeEtherReg(EWRPTL, LOBYTE(0x1A0A));
-    writeEtherReg(EWRPTH, HIBYTE(0x1A0A));
+    writeEtherReg(EWRPTL, LOBYTE(start));
+    writeEtherReg(EWRPTH, HIBYTE(start));
 
     // start FIFO buffer write
     startEtherMemWrite();
@@ -463,25 +971,52 @@ bool putEtherPacket(etherHeader *ether, uint16_t size)
     writeEtherMem(0);
 
     // write data
-    for (i = 0; i < size; i++)
-        writeEtherMem(packet[i]);
+    writeEtherMemBlock((uint8_t*)ether, size);
 
     // stop write
     stopEtherMemWrite();
-  
-    // request transmit
-    writeEtherReg(ETXSTL, LOBYTE(0x1A0A));
-    writeEtherReg(ETXSTH, HIBYTE(0x1A0A));
-    writeEtherReg(ETXNDL, LOBYTE(0x1A0A+size));
-    writeEtherReg(ETXNDH, HIBYTE(0x1A0A+size));
-    clearEtherReg(EIR, TXIF);
-    setEtherReg(ECON1, TXRTS);
 
-    // wait for completion
-    while ((readEtherReg(ECON1) & TXRTS) != 0);
+    txSize[slot] = size;
+    return slot;
+}
 
-    // determine success
-    return ((readEtherReg(ESTAT) & TXABORT) == 0);
+// Writes a packet
+// In async tx mode the frame is copied to the next transmit slot and queued,
+// only blocking if that slot is still waiting to go out, and true is
+// returned if it was queued. Otherwise waits for the frame to be sent and
+// returns true if it was not aborted.
+bool putEtherPacket(etherHeader *ether, uint16_t size)
+{
+    return queueEtherTx(writeEtherTxSlot(ether, size));
+}
+
+// Writes a packet, letting the controller checksum it once staged
+// Bytes from sumStart to the end of the frame are summed and the result is
+// written at sumOffset, which must hold the (uncomplemented) sum of anything
+// else to include, e.g. the pseudo-header
+// Only valid with ETHER_CSUM_OFFLOAD, check isEtherChecksumOffload() and
+// compute the checksum in software otherwise
+// Returns same as putEtherPacket()
+bool putEtherPacketWithChecksum(etherHeader *ether, uint16_t size, uint16_t sumStart, uint16_t sumOffset)
+{
+    uint8_t slot;
+    uint16_t start, csum;
+    slot = writeEtherTxSlot(ether, size);
+    if (csumOffload)
+    {
+        start = getEtherTxSlotAddress(slot) + 1;    // skip control byte
+        csum = sumEtherMem(start + sumStart, start + size - 1);
+
+        // store result in staged frame
+        setEtherBank(EWRPTL);
+        writeEtherReg(EWRPTL, LOBYTE(start + sumOffset));
+        writeEtherReg(EWRPTH, HIBYTE(start + sumOffset));
+        startEtherMemWrite();
+        writeEtherMem(LOBYTE(csum));
+        writeEtherMem(HIBYTE(csum));
+        stopEtherMemWrite();
+    }
+    return queueEtherTx(slot);
 }
 
 // Converts from host to network order and vice versa
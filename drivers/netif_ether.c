@@ -0,0 +1,163 @@
+/******************************************************************************
+ * File:        netif_ether.c
+ *
+ * Author:      Giancarlo Perez
+ *
+ * Created:     10/17/26
+ *
+ * Description: ENC28J60 network interface backend, thin wrappers around eth0.
+ *              main() registers it with setNetif(getEtherNetif())
+ ******************************************************************************/
+
+//=============================================================================
+// INCLUDES
+//=============================================================================
+
+#include "netif.h"
+#include "eth0.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+//=============================================================================
+// STATIC FUNCTIONS
+//=============================================================================
+
+static bool etherIsRxPending(netif* nif) {
+    (void)nif;
+    return isEtherRxPending();
+}
+
+static bool etherGetRxEventTime(netif* nif, uint32_t* cycles) {
+    (void)nif;
+    return getEtherRxEventTime(cycles);
+}
+
+static uint8_t etherGetRxCount(netif* nif) {
+    (void)nif;
+    return getEtherPacketCount();
+}
+
+static uint16_t etherPeek(netif* nif, etherHeader* ether, uint16_t peekSize) {
+    (void)nif;
+    return peekEtherPacket(ether, peekSize);
+}
+
+static uint16_t etherFinish(netif* nif, etherHeader* ether, uint16_t maxSize) {
+    (void)nif;
+    return finishEtherPacket(ether, maxSize);
+}
+
+static void etherDiscard(netif* nif) {
+    (void)nif;
+    discardEtherPacket();
+}
+
+static bool etherIsRxOverflow(netif* nif) {
+    (void)nif;
+    return isEtherOverflow();
+}
+
+static bool etherGetRxChecksum(netif* nif, uint16_t offset, uint16_t size, uint16_t* csum) {
+    (void)nif;
+    return getEtherRxChecksum(offset, size, csum);
+}
+
+// Passes unicast to our MAC, all ARP (pattern match, so gratuitous ARPs and
+// requests between other hosts can refresh the cache), the multicast groups
+// (hash table) and other broadcasts only when asked to
+static void etherSetRxFilter(netif* nif, bool broadcast, const uint8_t groups[][HW_ADD_LENGTH],
+                             uint8_t groupCount) {
+    uint8_t window[ETHER_PATTERN_SIZE];
+    uint8_t mask[ETHER_PATTERN_SIZE / 8];
+    uint8_t filter = ETHER_UNICAST | ETHER_PATTERNMATCH;
+    uint8_t i;
+    (void)nif;
+    memset(window, 0, sizeof(window));
+    memset(mask, 0, sizeof(mask));
+    //ethertype ARP (bytes 12-13)
+    window[12] = HIBYTE(TYPE_ARP);
+    window[13] = LOBYTE(TYPE_ARP);
+    for (i = 12; i < 14; i++) {
+        mask[i / 8] |= 1 << (i % 8);
+    }
+    setEtherPatternMatch(0, window, mask);
+    if (groupCount > 0) {
+        setEtherMulticastHash(groups, groupCount);
+        filter |= ETHER_HASHTABLE;
+    }
+    if (broadcast) {
+        filter |= ETHER_BROADCAST;
+    }
+    setEtherReceiveFilter(filter);
+}
+
+static bool etherTx(netif* nif, etherHeader* ether, uint16_t size) {
+    (void)nif;
+    return putEtherPacket(ether, size);
+}
+
+static bool etherIsChecksumOffload(netif* nif) {
+    (void)nif;
+    return isEtherChecksumOffload();
+}
+
+static bool etherTxWithChecksum(netif* nif, etherHeader* ether, uint16_t size, uint16_t sumStart,
+                                uint16_t sumOffset) {
+    (void)nif;
+    return putEtherPacketWithChecksum(ether, size, sumStart, sumOffset);
+}
+
+static void etherPoll(netif* nif) {
+    (void)nif;
+    pollEtherTx();
+}
+
+static bool etherIsTxBusy(netif* nif) {
+    (void)nif;
+    return isEtherTxBusy();
+}
+
+static bool etherIsLinkUp(netif* nif) {
+    (void)nif;
+    return isEtherLinkUp();
+}
+
+static void etherGetMacAddress(netif* nif, uint8_t mac[HW_ADD_LENGTH]) {
+    (void)nif;
+    getEtherMacAddress(mac);
+}
+
+//=============================================================================
+// GLOBALS
+//=============================================================================
+
+static const netifOps etherOps = {
+    .isRxPending = etherIsRxPending,
+    .getRxEventTime = etherGetRxEventTime,
+    .getRxCount = etherGetRxCount,
+    .peek = etherPeek,
+    .finish = etherFinish,
+    .discard = etherDiscard,
+    .isRxOverflow = etherIsRxOverflow,
+    .getRxChecksum = etherGetRxChecksum,
+    .setRxFilter = etherSetRxFilter,
+    .tx = etherTx,
+    .isChecksumOffload = etherIsChecksumOffload,
+    .txWithChecksum = etherTxWithChecksum,
+    .poll = etherPoll,
+    .isTxBusy = etherIsTxBusy,
+    .isLinkUp = etherIsLinkUp,
+    .getMacAddress = etherGetMacAddress
+};
+
+static netif etherNetif = { .name = "eth0", .ops = &etherOps };
+
+//=============================================================================
+// PUBLIC FUNCTIONS
+//=============================================================================
+
+// The ENC28J60 interface (eth0)
+netif* getEtherNetif(void) {
+    return &etherNetif;
+}
@@ -32,6 +32,9 @@
 #define SSI0FSS PORTA,3
 #define SSI0CLK PORTA,2
 
+// Depth of the SSI tx and rx FIFOs
+#define SSI0_FIFO_DEPTH 8
+
 //-----------------------------------------------------------------------------
 // Global variables
 //-----------------------------------------------------------------------------
@@ -103,3 +106,40 @@ uint32_t readSpi0Data()
 {
     return SSI0_DR_R;
 }
+
+// Blocking function that writes a block of bytes, keeping the tx FIFO full
+// No more than the FIFO depth is ever in flight so the rx FIFO cannot overrun
+// Received bytes are discarded
+void writeSpi0Block(const uint8_t data[], uint16_t size)
+{
+    uint16_t tx = 0, rx = 0;
+    while (rx < size)
+    {
+        if ((tx < size) && ((uint16_t)(tx - rx) < SSI0_FIFO_DEPTH) && (SSI0_SR_R & SSI_SR_TNF))
+            SSI0_DR_R = data[tx++];
+        if (SSI0_SR_R & SSI_SR_RNE)
+        {
+            (void)SSI0_DR_R;
+            rx++;
+        }
+    }
+    while (SSI0_SR_R & SSI_SR_BSY);
+}
+
+// Blocking function that reads a block of bytes by clocking out zeros,
+// keeping the tx FIFO full
+void readSpi0Block(uint8_t data[], uint16_t size)
+{
+    uint16_t tx = 0, rx = 0;
+    while (rx < size)
+    {
+        if ((tx < size) && ((uint16_t)(tx - rx) < SSI0_FIFO_DEPTH) && (SSI0_SR_R & SSI_SR_TNF))
+        {
+            SSI0_DR_R = 0;
+            tx++;
+        }
+        if (SSI0_SR_R & SSI_SR_RNE)
+            data[rx++] = SSI0_DR_R;
+    }
+    while (SSI0_SR_R & SSI_SR_BSY);
+}
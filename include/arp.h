@@ -26,13 +26,65 @@
 
 #define MAX_ARP_ENTRIES 20
 
+/* Hash buckets, a power of 2 comfortably above MAX_ARP_ENTRIES keeps the
+ * chains one entry long on average */
+#define ARP_HASH_BITS 5
+#define ARP_HASH_SIZE (1 << ARP_HASH_BITS)
+
+/* Entry States */
+#define ARP_FREE       0
+#define ARP_INCOMPLETE 1   // request sent, no reply yet
+#define ARP_REACHABLE  2   // confirmed within ARP_REACHABLE_SECONDS
+#define ARP_STALE      3   // still used, dropped after ARP_STALE_SECONDS more
+
+/* Aging */
+#ifndef ARP_REACHABLE_SECONDS
+#define ARP_REACHABLE_SECONDS 60
+#endif
+#ifndef ARP_STALE_SECONDS
+#define ARP_STALE_SECONDS 540
+#endif
+#ifndef ARP_AGING_SECONDS
+#define ARP_AGING_SECONDS 5
+#endif
+
+/* Refresh, entries looked up within ARP_REFRESH_IDLE_SECONDS get a unicast
+ * request ARP_REFRESH_SECONDS before they would go stale, repeated every
+ * aging pass up to ARP_REFRESH_PROBES times (so keep ARP_REFRESH_SECONDS
+ * above ARP_AGING_SECONDS). If the last one is not answered by the next pass
+ * the entry is dropped */
+#ifndef ARP_REFRESH_SECONDS
+#define ARP_REFRESH_SECONDS 15
+#endif
+#ifndef ARP_REFRESH_IDLE_SECONDS
+#define ARP_REFRESH_IDLE_SECONDS 60
+#endif
+#ifndef ARP_REFRESH_PROBES
+#define ARP_REFRESH_PROBES 3
+#endif
+
+/* Outstanding requests and the callers that can share each one */
+#define MAX_ARP_REQUESTS 5
+#define MAX_ARP_WAITERS 4
+
+/* Frames held while their next hop is resolved */
+#ifndef ARP_PENDING_FRAMES
+#define ARP_PENDING_FRAMES 4
+#endif
+#ifndef ARP_PENDING_PER_HOST
+#define ARP_PENDING_PER_HOST 3     // oldest is dropped past this
+#endif
+#ifndef ARP_PENDING_FRAME_SIZE
+#define ARP_PENDING_FRAME_SIZE 600
+#endif
+
 //=============================================================================
 // TYPEDEFS AND GLOBALS
 //=============================================================================
 
 typedef struct _arpRespContext {
     uint8_t success;
-    //uint8_t remoteIpAddress[4];
+    uint8_t remoteIpAddress[4];    // address that was resolved (next hop)
     uint8_t responseMacAddress[6];
     void* ctxt;
 } arpRespContext;
@@ -52,38 +104,68 @@ typedef struct _arpPacket { // 28 bytes
 } arpPacket;
 
 typedef struct {
-    uint8_t ipAddress[4];  // Key: IP address
+    uint32_t ipAddress;    // Key: IP address (convertIpAddressToU32)
     uint8_t macAddress[6]; // Value: MAC address
-    uint8_t valid;
+    uint8_t state;
+    uint8_t next;          // next entry in the bucket or free list
+    uint8_t probes;        // refresh requests sent since last confirmed
+    uint32_t updated;      // ms, last time the MAC was confirmed
+    uint32_t used;         // ms, last lookup (for eviction), 0 if never looked up
 } arp_entry_t;
 
+typedef struct _arpWaiter {
+    _arp_callback_t callback;
+    void* ctxt;
+} arpWaiter;
+
+// One in-flight request per next hop, every caller waiting on that address
+// is added to it instead of sending its own
 typedef struct _arpRequest {
     uint8_t ipAdd[4];
-    uint8_t hwAdd[6];
     uint8_t attempts;
-    uint8_t arpTimer;
-    void* ctxt;
-    _arp_callback_t callback;
+    uint8_t waiterCount;
+    uint16_t arpTimer;     // INVALID_TIMER when the slot is free
+    arpWaiter waiters[MAX_ARP_WAITERS];
 } arpRequest;
 
-
-extern arp_entry_t arpTable[MAX_ARP_ENTRIES];
+typedef struct _arpStats {
+    uint32_t requests;          // resolutions started
+    uint32_t coalesced;         // callers that joined one already in flight
+    uint32_t learned;           // entries added from traffic we did not ask for
+    uint32_t refreshes;         // unicast requests sent to keep entries in use fresh
+    uint32_t refreshed;         // entries confirmed again after a refresh request
+    uint32_t refreshFailed;     // entries dropped after no refresh request was answered
+    uint32_t pendingQueued;     // frames held for resolution
+    uint32_t pendingSent;       // sent once the reply came in
+    uint32_t pendingTimeouts;   // dropped because resolution failed
+    uint32_t pendingOverflows;  // dropped because the pool or host queue was full
+} arpStats;
 
 //=============================================================================
 // FUNCTION PROTOTYPES
 //=============================================================================
 
+void initArp();
 void displayArpTable();
 void clearArpTable();
 void addArpEntry(uint8_t ipAddress[], uint8_t macAddress[]);
 uint8_t lookupArpEntry(uint8_t ipAddress[], uint8_t macAddressToWrite[]);
+void removeArpEntry(uint8_t ipAddress[]);
+uint8_t getArpEntryCount();
 inline arpPacket* getArpPacket(etherHeader* ether);
 void resolveMacAddress(uint8_t ipAdd[4], _arp_callback_t cb, void* ctxt);
+bool lookupArpNextHop(uint8_t ipAdd[4], uint8_t macAddressToWrite[]);
+bool queueArpFrame(uint8_t ipAdd[4], etherHeader* ether, uint16_t size, _arp_callback_t failed, void* ctxt);
+void getArpStats(arpStats* stats);
 void processArpResponse(etherHeader* ether);
+void learnArpEntry(uint8_t ipAddress[], uint8_t macAddress[], bool create);
+void learnArpSender(etherHeader* ether);
 bool isArpResponse(etherHeader *ether);
 void sendArpResponse(etherHeader *ether);
 bool isArpRequest(etherHeader* ether);
 void sendArpRequest(etherHeader *ether, uint8_t ipFrom[], uint8_t ipTo[]);
+void sendArpRequestTo(etherHeader *ether, uint8_t ipFrom[], uint8_t ipTo[], const uint8_t macTo[]);
+void sendGratuitousArp(etherHeader* ether);
 
 #endif
 
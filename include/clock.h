@@ -19,11 +19,17 @@
 // DEFINES AND MACROS
 //=============================================================================
 
+/* DWT cycle counter (not in tm4c123gh6pm.h) */
+#define DWT_CTRL_R          (*((volatile uint32_t *)0xE0001000))
+#define DWT_CYCCNT_R        (*((volatile uint32_t *)0xE0001004))
+#define DWT_CTRL_CYCCNTENA  0x00000001
+#define DEMCR_TRCENA        0x01000000  // in NVIC_DBG_INT_R (DEMCR)
+
 //=============================================================================
 // TYPEDEFS AND GLOBALS
 //=============================================================================
 
-extern uint32_t systime;
+extern volatile uint32_t systime;
 
 //=============================================================================
 // FUNCTION PROTOTYPES
@@ -32,6 +38,8 @@ extern uint32_t systime;
 void initSystemClockTo40Mhz(void);
 void initSysTimer1ms();
 uint32_t millis();
+void initCycleCounter();
+uint32_t getCycleCount();
 void sysTickIsr();
 
 #endif
@@ -122,9 +122,11 @@ void processDhcpArpResponse(etherHeader *ether);
 void enableDhcp(void);
 void disableDhcp(void);
 bool isDhcpEnabled(void);
+bool isDhcpBroadcastNeeded(void);
 void renewDhcp(void);
 void releaseDhcp(void);
 uint32_t getDhcpLeaseSeconds();
+uint8_t getDhcpState();
 
 #endif
 
@@ -62,6 +62,23 @@ typedef struct _etherHeader // 14 bytes
 
 #define ETHER_HALFDUPLEX     0x00
 #define ETHER_FULLDUPLEX     0x100
+#define ETHER_ASYNC_TX       0x200
+#define ETHER_FLOWCONTROL    0x400
+#define ETHER_CSUM_OFFLOAD   0x800     // ignored unless built with ETHER_CSUM_OFFLOAD_ENABLED
+
+// Number of transmit slots in controller memory (1 to ETHER_MAX_TX_SLOTS)
+// Each slot takes 1526 bytes from the receive buffer
+// Defaults to 1, or 2 in async tx mode
+#define ETHER_TX_SLOTS_SHIFT 12
+#define ETHER_TX_SLOTS_MASK  0x7000
+#define ETHER_TX_SLOTS(n)    (((n) << ETHER_TX_SLOTS_SHIFT) & ETHER_TX_SLOTS_MASK)
+
+#define ETHER_RX_EVENT_QUEUE_SIZE 8   // power of 2
+
+// Pattern match window size (bytes)
+#define ETHER_PATTERN_SIZE   64
+
+#define ETHER_MAX_TX_SLOTS    4
 
 #define LOBYTE(x) ((x) & 0xFF)
 #define HIBYTE(x) (((x) >> 8) & 0xFF)
@@ -70,6 +87,18 @@ typedef struct _etherHeader // 14 bytes
 #define IP_ADD_LENGTH 4
 #define HW_ADD_LENGTH 6
 
+// Driver counters
+typedef struct _etherStats
+{
+  uint32_t rxEvents;            // receive interrupts handled
+  uint32_t rxEventDrops;        // receive interrupts lost to a full event queue
+  uint32_t rxOverflows;         // rx buffer overflows (RXERIF)
+  uint32_t rxDrops;             // frames thrown away by rx resets
+  uint32_t rxResets;            // rx resets after a corrupt receive header
+  uint32_t flowControlEvents;   // times pause/backpressure was turned on
+  uint8_t  rxPacketsHighWater;  // most packets seen waiting in the rx buffer
+} etherStats;
+
 extern const uint8_t EMPTY_MAC_ADDRESS[HW_ADD_LENGTH];
 extern const uint8_t BROADCAST_MAC_ADDRESS[HW_ADD_LENGTH];
 
@@ -79,11 +108,29 @@ extern const uint8_t BROADCAST_MAC_ADDRESS[HW_ADD_LENGTH];
 
 void initEther(uint16_t mode);
 bool isEtherLinkUp(void);
+void setEtherReceiveFilter(uint8_t filter);
+void setEtherPatternMatch(uint16_t offset, const uint8_t window[ETHER_PATTERN_SIZE], const uint8_t mask[ETHER_PATTERN_SIZE / 8]);
+uint8_t getEtherHashIndex(const uint8_t mac[HW_ADD_LENGTH]);
+void setEtherMulticastHash(const uint8_t macs[][HW_ADD_LENGTH], uint8_t count);
 
 bool isEtherDataAvailable(void);
 bool isEtherOverflow(void);
+void etherIsr(void);
+bool isEtherRxPending(void);
+bool getEtherRxEventTime(uint32_t* cycles);
+uint8_t getEtherPacketCount(void);
+void getEtherStats(etherStats* s);
+void resetEtherRx(void);
 uint16_t getEtherPacket(etherHeader *Ether, uint16_t maxSize);
+uint16_t peekEtherPacket(etherHeader *Ether, uint16_t peekSize);
+uint16_t finishEtherPacket(etherHeader *Ether, uint16_t maxSize);
+void discardEtherPacket(void);
 bool putEtherPacket(etherHeader *Ether, uint16_t size);
+bool putEtherPacketWithChecksum(etherHeader *Ether, uint16_t size, uint16_t sumStart, uint16_t sumOffset);
+bool isEtherChecksumOffload(void);
+bool getEtherRxChecksum(uint16_t offset, uint16_t size, uint16_t* csum);
+void pollEtherTx(void);
+bool isEtherTxBusy(void);
 
 void copyMacAddress(uint8_t dest[6], const uint8_t src[6]);
 void setEtherMacAddress(uint8_t mac0, uint8_t mac1, uint8_t mac2, uint8_t mac3, uint8_t mac4, uint8_t mac5);
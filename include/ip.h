@@ -66,11 +66,14 @@ uint32_t convertIpAddressToU32(const uint8_t ip[4]);
 void copyIpAddress(uint8_t dest[4], const uint8_t source[4]);
 
 void sumIpWords(void* data, uint16_t sizeInBytes, uint32_t* sum);
+void copyIpWords(void* dest, const void* src, uint16_t sizeInBytes, uint32_t* sum);
+void sumIpPseudoHeader(ipHeader* ip, uint16_t length, uint32_t* sum);
 void calcIpChecksum(ipHeader* ip);
 uint16_t getIpChecksum(uint32_t sum);
 
 void setIpAddress(const uint8_t ip[4]);
 void getIpAddress(uint8_t ip[4]);
+uint16_t getIpAddressGeneration(void);
 void setIpSubnetMask(const uint8_t mask[4]);
 void getIpSubnetMask(uint8_t mask[4]);
 void setIpGatewayAddress(const uint8_t ip[4]);
@@ -131,8 +131,8 @@ typedef struct _mqttClient {
     mqtt_callback_t pubCallback;
 
     //timers
-    uint8_t timeoutTimer;
-    uint8_t keepAliveTimer;
+    uint16_t timeoutTimer;
+    uint16_t keepAliveTimer;
 } mqttClient;
 
 typedef struct _mqttBroker {
@@ -0,0 +1,131 @@
+/******************************************************************************
+ * File:        netif.h
+ *
+ * Author:      Giancarlo Perez
+ *
+ * Created:     10/17/26
+ *
+ * Description: Network interface layer. The stack talks to an interface
+ *              through an ops table so the ENC28J60 can be swapped for a
+ *              loopback or an in-memory queue (e.g. a host build)
+ ******************************************************************************/
+
+#ifndef NETIF_H_
+#define NETIF_H_
+
+//=============================================================================
+// INCLUDES
+//=============================================================================
+
+#include "eth0.h"
+#include "ip.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+//=============================================================================
+// DEFINES AND MACROS
+//=============================================================================
+
+/* Frames buffered by a queue/loopback interface (power of 2) */
+#ifndef NETIF_QUEUE_SIZE
+#define NETIF_QUEUE_SIZE 2
+#endif
+
+//=============================================================================
+// TYPEDEFS AND GLOBALS
+//=============================================================================
+
+typedef struct _netif netif;
+
+// Per-interface IP configuration (what used to be the globals in ip.c)
+typedef struct _ipConfig {
+    uint8_t address[IP_ADD_LENGTH];
+    uint8_t subnetMask[IP_ADD_LENGTH];
+    uint8_t gateway[IP_ADD_LENGTH];
+    uint8_t dns[IP_ADD_LENGTH];
+    uint8_t timeServer[IP_ADD_LENGTH];
+    uint8_t mqttBroker[IP_ADD_LENGTH];
+    uint16_t generation; // bumped whenever the local address changes
+} ipConfig;
+
+// Backend operations, entries marked optional may be NULL
+typedef struct _netifOps {
+    /* Receive */
+    bool     (*isRxPending)(netif* nif);
+    bool     (*getRxEventTime)(netif* nif, uint32_t* cycles);             // optional
+    uint8_t  (*getRxCount)(netif* nif);
+    uint16_t (*peek)(netif* nif, etherHeader* ether, uint16_t peekSize);   // returns full frame size
+    uint16_t (*finish)(netif* nif, etherHeader* ether, uint16_t maxSize);  // copies the rest, frees it
+    void     (*discard)(netif* nif);
+    bool     (*isRxOverflow)(netif* nif);                                  // optional
+    bool     (*getRxChecksum)(netif* nif, uint16_t offset, uint16_t size, uint16_t* csum); // optional
+    void     (*setRxFilter)(netif* nif, bool broadcast, const uint8_t groups[][HW_ADD_LENGTH],
+                            uint8_t groupCount);                           // optional
+    /* Transmit */
+    bool     (*tx)(netif* nif, etherHeader* ether, uint16_t size);
+    bool     (*isChecksumOffload)(netif* nif);                             // optional
+    bool     (*txWithChecksum)(netif* nif, etherHeader* ether, uint16_t size, uint16_t sumStart,
+                               uint16_t sumOffset);                        // optional
+    void     (*poll)(netif* nif);                                          // optional
+    bool     (*isTxBusy)(netif* nif);   // optional, frames queued or on the wire
+    /* Link */
+    bool     (*isLinkUp)(netif* nif);
+    void     (*getMacAddress)(netif* nif, uint8_t mac[HW_ADD_LENGTH]);
+} netifOps;
+
+typedef struct _netifFrame {
+    uint16_t size;
+    uint8_t data[MAX_PACKET_SIZE];
+} netifFrame;
+
+// Frame ring owned by a queue/loopback interface
+typedef struct _netifQueue {
+    netifFrame frames[NETIF_QUEUE_SIZE];
+    uint8_t head;      // next frame to receive
+    uint8_t count;
+    uint16_t rxRead;   // bytes of the head frame already peeked
+    uint32_t drops;    // frames lost to a full queue
+} netifQueue;
+
+struct _netif {
+    const char* name;
+    const netifOps* ops;
+    ipConfig ip;
+    /* Queue/loopback backends only */
+    netifQueue* rxQueue;
+    netif* peer;       // where transmitted frames are delivered
+    uint8_t macAddress[HW_ADD_LENGTH];
+};
+
+//=============================================================================
+// FUNCTION PROTOTYPES
+//=============================================================================
+
+/* Interfaces */
+netif* getEtherNetif(void);    // drivers/netif_ether.c
+void initLoopbackNetif(netif* nif, netifQueue* queue);
+void initQueueNetif(netif* nif, const char* name, netifQueue* queue, const uint8_t mac[HW_ADD_LENGTH]);
+void connectQueueNetifs(netif* a, netif* b);
+void setNetif(netif* nif);
+netif* getNetif(void);
+ipConfig* getNetifIpConfig(void);
+
+/* Operations on the current interface */
+bool isNetifRxPending(void);
+bool getNetifRxEventTime(uint32_t* cycles);
+uint8_t getNetifPacketCount(void);
+uint16_t peekNetifPacket(etherHeader* ether, uint16_t peekSize);
+uint16_t finishNetifPacket(etherHeader* ether, uint16_t maxSize);
+void discardNetifPacket(void);
+bool isNetifRxOverflow(void);
+bool getNetifRxChecksum(uint16_t offset, uint16_t size, uint16_t* csum);
+void setNetifReceiveFilter(bool broadcast, const uint8_t groups[][HW_ADD_LENGTH], uint8_t groupCount);
+bool putNetifPacket(etherHeader* ether, uint16_t size);
+bool isNetifChecksumOffload(void);
+bool putNetifPacketWithChecksum(etherHeader* ether, uint16_t size, uint16_t sumStart, uint16_t sumOffset);
+void pollNetif(void);
+bool isNetifTxBusy(void);
+bool isNetifLinkUp(void);
+void getNetifMacAddress(uint8_t mac[HW_ADD_LENGTH]);
+
+#endif
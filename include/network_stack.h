@@ -14,6 +14,15 @@
 #define EEPROM_MQTT        7
 #define EEPROM_ERASED      0xFFFFFFFF
 
+// Most frames taken from the rx buffer per runNetworkRx() call
+#define MAX_RX_PACKETS_PER_PASS 4
+
+// How long the red LED stays on after an rx overflow (ms)
+#define OVERFLOW_LED_TIME 100
+
+// Multicast groups the receive filter can pass
+#define MAX_MULTICAST_GROUPS 4
+
 // Pins
 #define RED_LED PORTF,1
 #define BLUE_LED PORTF,2
@@ -22,7 +31,11 @@
 
 bool isNetworkReady(void);
 void netstat(void);
+void stats(void);
 void readConfiguration(void);
-void runNetworkStack(void);
+void updateReceiveFilter(void);
+bool joinMulticastGroup(const uint8_t mac[6]);
+void runNetworkTx(void);
+void runNetworkRx(void);
 
 #endif
@@ -0,0 +1,76 @@
+/******************************************************************************
+ * File:        packet.h
+ *
+ * Author:      Giancarlo Perez
+ *
+ * Created:     10/17/26
+ *
+ * Description: Single-pass receive classifier
+ ******************************************************************************/
+
+#ifndef PACKET_H_
+#define PACKET_H_
+
+//=============================================================================
+// INCLUDES
+//=============================================================================
+
+#include "eth0.h"
+#include "ip.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+//=============================================================================
+// DEFINES AND MACROS
+//=============================================================================
+
+/* Packet Types (handler to dispatch to) */
+#define PACKET_DROP         0
+#define PACKET_ARP_REQUEST  1
+#define PACKET_ARP_RESPONSE 2
+#define PACKET_ICMP         3
+#define PACKET_TCP          4
+#define PACKET_UDP          5
+#define PACKET_DHCP         6
+#define PACKET_ARP_OTHER    7   // request for another host or a gratuitous ARP
+
+/* Bytes read from the controller before deciding whether to copy the rest */
+#define PACKET_PEEK_SIZE    64
+
+//=============================================================================
+// TYPEDEFS AND GLOBALS
+//=============================================================================
+
+// Everything the handlers need to know about a received frame, filled in once
+// by parsePacket() so that no layer has to re-validate the headers
+typedef struct _packetInfo {
+    etherHeader* ether;
+    uint16_t size;          // bytes received
+    uint16_t etherType;     // host order
+    uint8_t  type;          // PACKET_*
+    uint8_t  protocol;      // IP protocol, 0 if not IP
+    uint16_t ipOffset;      // offset of ARP/IP header from start of frame
+    uint16_t l4Offset;      // offset of ICMP/TCP/UDP header
+    uint16_t payloadOffset; // offset of L4 payload
+    uint16_t sourcePort;    // host order
+    uint16_t destPort;      // host order
+    uint8_t* payload;
+    uint16_t payloadLength;
+    bool     ipChecksumOk;
+    bool     l4ChecksumOk;
+    bool     unicast;       // IP destination is our address
+    // Set by the caller before parsePacket() if the controller already summed
+    // the L4 bytes (see getEtherRxChecksum), left alone by parsePacket()
+    bool     hwChecksumValid;
+    uint16_t hwChecksum;
+} packetInfo;
+
+//=============================================================================
+// FUNCTION PROTOTYPES
+//=============================================================================
+
+uint8_t parsePacket(etherHeader* ether, uint16_t size, packetInfo* pkt);
+bool isPacketWanted(etherHeader* ether, uint16_t size);
+bool getPacketL4Range(etherHeader* ether, uint16_t size, uint16_t* offset, uint16_t* length);
+
+#endif
@@ -0,0 +1,85 @@
+/******************************************************************************
+ * File:        profiler.h
+ *
+ * Author:      Giancarlo Perez
+ *
+ * Created:     10/17/26
+ *
+ * Description: Per-stage cycle profiler. Build with PROFILE_ENABLED defined
+ *              to turn it on, otherwise every PROFILE macro compiles to
+ *              just the code it wraps
+ ******************************************************************************/
+
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+//=============================================================================
+// INCLUDES
+//=============================================================================
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//=============================================================================
+// DEFINES AND MACROS
+//=============================================================================
+
+/* Stages */
+#define PROFILE_RX_FRAME        0   // reading or discarding a frame in the controller
+#define PROFILE_ARP             1
+#define PROFILE_ICMP            2
+#define PROFILE_TCP             3
+#define PROFILE_UDP             4
+#define PROFILE_DHCP            5
+#define PROFILE_TCP_PENDING     6   // sendTcpPendingMessages
+#define PROFILE_DHCP_PENDING    7   // sendDhcpPendingMessages
+#define PROFILE_TX_FRAME        8   // putNetifPacket
+#define PROFILE_MQTT            9   // runMqttClient
+#define PROFILE_STAGE_COUNT     10
+
+/* Histogram bucket i counts samples of 2^(i + PROFILE_HIST_SHIFT) time units
+ * or more, the first bucket also takes anything shorter */
+#define PROFILE_HIST_BUCKETS    16
+#define PROFILE_HIST_SHIFT      6
+
+#ifdef PROFILE_ENABLED
+// Times the statement(s) passed in, e.g. PROFILE(PROFILE_ARP, processArpData(pkt));
+#define PROFILE(stage, ...) do { \
+        uint32_t _profileStart = getProfileTime(); \
+        __VA_ARGS__; \
+        recordProfile(stage, getProfileTime() - _profileStart); \
+    } while (0)
+// For a whole function body, START must come after the declarations
+#define PROFILE_START(stage) uint32_t _profileStart##stage = getProfileTime()
+#define PROFILE_END(stage) recordProfile(stage, getProfileTime() - _profileStart##stage)
+#else
+#define PROFILE(stage, ...) do { __VA_ARGS__; } while (0)
+#define PROFILE_START(stage)
+#define PROFILE_END(stage)
+#endif
+
+//=============================================================================
+// TYPEDEFS AND GLOBALS
+//=============================================================================
+
+typedef struct _profileStats {
+    const char* name;
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+    uint32_t histogram[PROFILE_HIST_BUCKETS];
+} profileStats;
+
+//=============================================================================
+// FUNCTION PROTOTYPES
+//=============================================================================
+
+bool isProfileEnabled();
+uint32_t getProfileTime();
+uint32_t getProfileTicksPerUs();
+void recordProfile(uint8_t stage, uint32_t elapsed);
+bool getProfileStats(uint8_t stage, profileStats* stats);
+void resetProfile();
+
+#endif
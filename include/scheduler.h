@@ -0,0 +1,80 @@
+/******************************************************************************
+ * File:        scheduler.h
+ *
+ * Author:      Giancarlo Perez
+ *
+ * Created:     10/17/26
+ *
+ * Description: Cooperative run-to-completion scheduler for the main loop
+ ******************************************************************************/
+
+#ifndef SCHEDULER_H_
+#define SCHEDULER_H_
+
+//=============================================================================
+// INCLUDES
+//=============================================================================
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//=============================================================================
+// DEFINES AND MACROS
+//=============================================================================
+
+#define MAX_TASKS 8
+#define INVALID_TASK 0xFF
+
+/* Priority classes, lower values run first in every pass */
+#define SCHED_PRIORITY_RX    0
+#define SCHED_PRIORITY_TIMER 1
+#define SCHED_PRIORITY_TX    2
+#define SCHED_PRIORITY_APP   3
+#define SCHED_PRIORITY_SHELL 4
+
+/* Cycles a pass may take before lower priority tasks wait for the next one
+ * (40 MHz, so 1 ms) */
+#ifndef SCHED_PASS_BUDGET
+#define SCHED_PASS_BUDGET 40000
+#endif
+
+/* Passes a task can be put off before it runs regardless of the budget */
+#define SCHED_MAX_DEFERRALS 4
+
+//=============================================================================
+// TYPEDEFS AND GLOBALS
+//=============================================================================
+
+typedef void (*_task_callback_t)(void);
+typedef bool (*_task_ready_t)(void);
+typedef bool (*_task_ready_time_t)(uint32_t* cycles);   // false if not known
+
+typedef struct _taskStats {
+    const char* name;
+    uint8_t priority;
+    uint32_t runs;
+    uint32_t overrunCycles;  // cycles one run is expected to fit in
+    uint32_t overruns;       // runs that took longer than overrunCycles
+    uint32_t maxCycles;
+    uint64_t totalCycles;
+    uint32_t maxLatency;     // cycles from its work arriving until the task ran
+    uint64_t totalLatency;
+    uint32_t deferrals;      // times put off by the pass budget
+} taskStats;
+
+//=============================================================================
+// FUNCTION PROTOTYPES
+//=============================================================================
+
+void initScheduler();
+uint8_t addTask(const char* name, uint8_t priority, _task_callback_t run, _task_ready_t isReady, uint32_t overrunCycles);
+bool setTaskReadyTime(_task_callback_t run, _task_ready_time_t getReadyTime);
+void requestSchedulerPass();
+void setIdleHook(_task_callback_t hook);
+void runScheduler();
+uint8_t getTaskCount();
+bool getTaskStats(uint8_t index, taskStats* stats);
+uint32_t getIdleCount();
+void resetSchedulerStats();
+
+#endif
@@ -36,9 +36,13 @@
 #define SOCKET_ERROR_ARP_TIMEOUT 1
 #define SOCKET_ERROR_TCP_SYN_ACK_TIMEOUT 2
 #define SOCKET_ERROR_CONNECTION_RESET 3
+#define SOCKET_ERROR_ARP_QUEUE_FULL 4
 
 #define MAX_SOCKETS 5
 
+/* Transmit Header Template */
+#define SOCKET_TX_HEADER_SIZE 54 // ether (14) + ip (20) + tcp (20), udp uses the first 42
+
 //=============================================================================
 // TYPEDEFS AND GLOBALS
 //=============================================================================
@@ -62,11 +66,18 @@ typedef struct _socket {
     uint8_t tx_buffer[256]; //max buffer size
     uint16_t tx_size;
     uint16_t flags;
-    uint8_t assocTimer;
+    uint16_t assocTimer;
     bool retransmitting;
     uint8_t connectAttempts;
     uint8_t  valid;
     _tim_callback_t errorCallback;
+    //Prebuilt ether/ip/l4 headers, only length, seq/ack and flags change per segment
+    uint8_t  txHeader[SOCKET_TX_HEADER_SIZE];
+    uint32_t txIpSum;               // ip header sum with length and checksum zeroed
+    uint32_t txPseudoSum;           // pseudo-header minus length
+    uint32_t txL4Sum;               // pseudo-header (minus length) + constant l4 fields
+    uint16_t txHeaderGeneration;    // ip address generation the template was built for
+    bool     txHeaderValid;
 } socket;
 
 typedef struct socketError {
@@ -96,6 +107,8 @@ void getSocketInfoFromArpResponse(etherHeader* ether, socket* s);
 void getSocketInfoFromUdpPacket(etherHeader* ether, socket* s);
 void getSocketInfoFromTcpPacket(etherHeader* ether, socket* s);
 void throwSocketError(socket* s, uint8_t errorCode);
+void invalidateSocketTxHeader(socket* s);
+void copySocketTxHeader(socket* s, uint8_t protocol, etherHeader* ether);
 
 
 #endif
@@ -22,8 +22,18 @@
 // DEFINES AND MACROS
 //=============================================================================
 
-#define NUM_TIMERS 25
-#define INVALID_TIMER 255
+#ifndef NUM_TIMERS
+#define NUM_TIMERS 25       // up to 254
+#endif
+#define INVALID_TIMER 0xFFFF
+
+// Most timer callbacks runTimers() will make in one call
+#ifndef TIMER_CALLBACK_BUDGET
+#define TIMER_CALLBACK_BUDGET 4
+#endif
+
+// Define TIMER_VIRTUAL_CLOCK (e.g. for a host build) to replace Timer 4 with
+// a clock that only moves when advanceTimerClock() is called
 
 //=============================================================================
 // TYPEDEFS AND GLOBALS
@@ -36,11 +46,20 @@ typedef void (*_tim_callback_t)(void*);
 //=============================================================================
 
 void initTimer();
-uint8_t startOneshotTimer(_tim_callback_t callback, uint32_t seconds, void* context);
-uint8_t startPeriodicTimer(_tim_callback_t callback, uint32_t seconds, void* context);
-bool stopTimer(uint8_t id);
-bool restartTimer(uint8_t id);
-void tickIsr();
+uint16_t startOneshotTimer(_tim_callback_t callback, uint32_t seconds, void* context);
+uint16_t startPeriodicTimer(_tim_callback_t callback, uint32_t seconds, void* context);
+uint16_t startOneshotTimerMs(_tim_callback_t callback, uint32_t ms, void* context);
+uint16_t startPeriodicTimerMs(_tim_callback_t callback, uint32_t ms, void* context);
+bool stopTimer(uint16_t id);
+bool restartTimer(uint16_t id);
 uint32_t random32();
+void runTimers();
+bool isTimerPending();
+#ifdef TIMER_VIRTUAL_CLOCK
+void advanceTimerClock(uint32_t ms);
+bool getNextTimerDeadline(uint32_t* ms);
+uint32_t runToNextTimer();
+void seedRandom32(uint32_t seed);
+#endif
 
 #endif
@@ -0,0 +1,85 @@
+/******************************************************************************
+ * File:        trace.h
+ *
+ * Author:      Giancarlo Perez
+ *
+ * Created:     10/17/26
+ *
+ * Description: Ring of compact timestamped events for reconstructing what
+ *              the stack did before a stall (see tools/trace_decode.py)
+ ******************************************************************************/
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+//=============================================================================
+// INCLUDES
+//=============================================================================
+
+#include "eth0.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+//=============================================================================
+// DEFINES AND MACROS
+//=============================================================================
+
+/* Events kept, must be a power of 2 */
+#ifndef TRACE_SIZE
+#define TRACE_SIZE 64
+#endif
+
+/* Bumped whenever the event layout changes so the decoder can tell */
+#define TRACE_VERSION 1
+
+/* Event Types
+ *                       a           b              c           d            e
+ * RX/TX_FRAME           ip proto    length|flags   src port    dest port    remote ip
+ *                       0 (not ip)  length         ethertype   arp op       arp ip
+ * TCP_STATE             new state   local port     old state   remote port  remote ip
+ * TIMER_FIRE            -           handle         -           -            callback
+ * ARP_REQUEST           -           -              -           -            target ip
+ * ARP_RESPONSE          -           -              -           -            sender ip
+ * DHCP_STATE            new state   -              old state   -            -
+ * SOCKET_ERROR          error code  local port     -           remote port  remote ip
+ */
+#define TRACE_RX_FRAME      1
+#define TRACE_TX_FRAME      2
+#define TRACE_TCP_STATE     3
+#define TRACE_TIMER_FIRE    4
+#define TRACE_ARP_REQUEST   5
+#define TRACE_ARP_RESPONSE  6
+#define TRACE_DHCP_STATE    7
+#define TRACE_SOCKET_ERROR  8
+
+/* Frames are at most 1518 bytes, so the top bits of b carry the TCP flags
+ * FIN, SYN, RST, PSH and ACK */
+#define TRACE_LENGTH_MASK   0x07FF
+#define TRACE_FLAGS_SHIFT   11
+
+//=============================================================================
+// TYPEDEFS AND GLOBALS
+//=============================================================================
+
+typedef struct _traceEvent { // 16 bytes
+    uint32_t time;          // ms
+    uint8_t  type;
+    uint8_t  a;
+    uint16_t b;
+    uint16_t c;
+    uint16_t d;
+    uint32_t e;
+} traceEvent;
+
+//=============================================================================
+// FUNCTION PROTOTYPES
+//=============================================================================
+
+void recordTrace(uint8_t type, uint8_t a, uint16_t b, uint16_t c, uint16_t d, uint32_t e);
+void recordTraceFrame(uint8_t type, etherHeader* ether, uint16_t size);
+uint16_t getTraceCount();
+uint32_t getTraceTotal();
+bool getTraceEvent(uint16_t index, traceEvent* event);
+void clearTrace();
+
+#endif
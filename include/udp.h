@@ -43,6 +43,7 @@ typedef struct _udpHeader {// 8 bytes
 bool isUdp(etherHeader *ether);
 inline udpHeader* getUdpHeader(etherHeader* ether);
 inline uint8_t* getUdpData(etherHeader *ether);
+uint16_t buildUdpMessage(etherHeader* ether, socket* s, uint8_t data[], uint16_t dataSize);
 void sendUdpMessage(etherHeader* ether, socket* s, uint8_t data[], uint16_t dataSize);
 
 #endif
@@ -17,6 +17,8 @@
 #include "mqtt.h"
 #include "strlib.h"
 #include "uart0.h"
+#include "profiler.h"
+#include "scheduler.h"
 #include <stdio.h>
 
 //=============================================================================
@@ -137,6 +139,7 @@ void runMqttClient() {
     socket* mqttSocket = client->socket;
     uint8_t mqttState = getMqttState();
     uint8_t tcpState = getTcpState(mqttSocket);
+    PROFILE_START(PROFILE_MQTT);
     switch (mqttState) {
     case MQTT_CLIENT_STATE_DISCONNECTED:
         break;
@@ -190,6 +193,11 @@ void runMqttClient() {
         }
         break;
     }
+    //the next state may have work to do right away (e.g. sending CONNECT)
+    if (getMqttState() != mqttState) {
+        requestSchedulerPass();
+    }
+    PROFILE_END(PROFILE_MQTT);
 }
 
 inline void setMqttState(uint8_t state) {
@@ -0,0 +1,126 @@
+/******************************************************************************
+ * File:        profiler.c
+ *
+ * Author:      Giancarlo Perez
+ *
+ * Created:     10/17/26
+ *
+ * Description: Per-stage cycle profiler. Times come from the DWT cycle
+ *              counter on the target and a monotonic clock (ns) on a host
+ ******************************************************************************/
+
+// clock_gettime() on a host built with -std=c99, has to come before any
+// system header
+#if !defined(__TI_ARM__) && !defined(__arm__)
+#define _POSIX_C_SOURCE 199309L
+#endif
+
+//=============================================================================
+// INCLUDES
+//=============================================================================
+
+#include "profiler.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#if defined(__TI_ARM__) || defined(__arm__)
+#include "clock.h"
+#else
+#include <time.h>
+#endif
+
+//=============================================================================
+// GLOBALS
+//=============================================================================
+
+#ifdef PROFILE_ENABLED
+static const char* profileNames[PROFILE_STAGE_COUNT] = {
+    "rx frame", "arp", "icmp", "tcp", "udp", "dhcp",
+    "tcp pend", "dhcp pend", "tx frame", "mqtt"
+};
+
+profileStats profile[PROFILE_STAGE_COUNT];
+#endif
+
+//=============================================================================
+// PUBLIC FUNCTIONS
+//=============================================================================
+
+bool isProfileEnabled() {
+#ifdef PROFILE_ENABLED
+    return true;
+#else
+    return false;
+#endif
+}
+
+uint32_t getProfileTime() {
+#if defined(__TI_ARM__) || defined(__arm__)
+    return getCycleCount();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)ts.tv_sec * 1000000000u + (uint32_t)ts.tv_nsec;
+#endif
+}
+
+// Converts getProfileTime() units for display
+uint32_t getProfileTicksPerUs() {
+#if defined(__TI_ARM__) || defined(__arm__)
+    return 40;
+#else
+    return 1000;
+#endif
+}
+
+#ifdef PROFILE_ENABLED
+
+void recordProfile(uint8_t stage, uint32_t elapsed) {
+    profileStats* p = &profile[stage];
+    uint32_t v = elapsed >> PROFILE_HIST_SHIFT;
+    uint8_t bucket = 0;
+    while (v > 1 && bucket < PROFILE_HIST_BUCKETS - 1) {
+        v >>= 1;
+        bucket++;
+    }
+    if (p->count == 0 || elapsed < p->min) {
+        p->min = elapsed;
+    }
+    if (elapsed > p->max) {
+        p->max = elapsed;
+    }
+    p->count++;
+    p->total += elapsed;
+    p->histogram[bucket]++;
+}
+
+bool getProfileStats(uint8_t stage, profileStats* stats) {
+    if (stage >= PROFILE_STAGE_COUNT) {
+        return false;
+    }
+    *stats = profile[stage];
+    stats->name = profileNames[stage];
+    return true;
+}
+
+void resetProfile() {
+    memset(profile, 0, sizeof(profile));
+}
+
+#else
+
+void recordProfile(uint8_t stage, uint32_t elapsed) {
+    (void)stage;
+    (void)elapsed;
+}
+
+bool getProfileStats(uint8_t stage, profileStats* stats) {
+    (void)stage;
+    (void)stats;
+    return false;
+}
+
+void resetProfile() {
+}
+
+#endif
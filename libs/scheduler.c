@@ -0,0 +1,224 @@
+/******************************************************************************
+ * File:        scheduler.c
+ *
+ * Author:      Giancarlo Perez
+ *
+ * Created:     10/17/26
+ *
+ * Description: Cooperative run-to-completion scheduler for the main loop
+ *
+ *              Each pass walks the tasks in priority order. Tasks with a
+ *              ready function only run when it says there is work, tasks
+ *              without one run every pass. Once a pass has used its cycle
+ *              budget the remaining tasks are put off to the next pass (but
+ *              never more than SCHED_MAX_DEFERRALS in a row). A pass where no
+ *              event-driven task was ready and no polled task asked for
+ *              another pass ends in the idle hook, which by default sleeps
+ *              until the next interrupt (ENC28J60 INT or the 1 ms tick)
+ *
+ *              Latency is measured from when a task's work arrived: the time
+ *              its ready-time function reports (e.g. the interrupt), else
+ *              when the scheduler first saw it ready, or the start of the
+ *              pass for polled tasks
+ ******************************************************************************/
+
+//=============================================================================
+// INCLUDES
+//=============================================================================
+
+#include "scheduler.h"
+#include "clock.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+//=============================================================================
+// DEFINES AND MACROS
+//=============================================================================
+
+#ifndef NULL
+ #define NULL 0
+#endif
+
+//=============================================================================
+// TYPEDEFS AND GLOBALS
+//=============================================================================
+
+typedef struct _task {
+    _task_callback_t run;
+    _task_ready_t isReady;          // NULL = polled every pass
+    _task_ready_time_t getReadyTime; // optional, see setTaskReadyTime()
+    uint8_t deferred;
+    uint32_t readySince;            // cycles, when its pending work arrived
+    taskStats stats;
+} task;
+
+task tasks[MAX_TASKS];       // sorted by priority
+uint8_t taskCount = 0;
+_task_callback_t idleHook = NULL;
+uint32_t idleCount = 0;
+bool passRequested = false;
+
+//=============================================================================
+// STATIC FUNCTIONS
+//=============================================================================
+
+// Sleeps until an interrupt unless a task became ready after it was checked
+// WFI still wakes on an interrupt that is pending while they are masked
+static void waitForInterrupt() {
+    uint8_t i;
+    bool ready = false;
+    __asm(" CPSID I");
+    for (i = 0; i < taskCount && !ready; i++) {
+        ready = tasks[i].isReady != NULL && tasks[i].isReady();
+    }
+    if (!ready) {
+        __asm(" WFI");
+    }
+    __asm(" CPSIE I");
+}
+
+//=============================================================================
+// PUBLIC FUNCTIONS
+//=============================================================================
+
+void initScheduler() {
+    taskCount = 0;
+    idleHook = waitForInterrupt;
+    idleCount = 0;
+    initCycleCounter();
+}
+
+// Adds a task behind any others of the same priority
+// Runs longer than overrunCycles are only counted, never cut short (0 = no limit)
+uint8_t addTask(const char* name, uint8_t priority, _task_callback_t run, _task_ready_t isReady, uint32_t overrunCycles) {
+    uint8_t i;
+    if (taskCount == MAX_TASKS) {
+        return INVALID_TASK;
+    }
+    i = taskCount;
+    while (i > 0 && tasks[i - 1].stats.priority > priority) {
+        tasks[i] = tasks[i - 1];
+        i--;
+    }
+    memset(&tasks[i], 0, sizeof(task));
+    tasks[i].run = run;
+    tasks[i].isReady = isReady;
+    tasks[i].stats.name = name;
+    tasks[i].stats.priority = priority;
+    tasks[i].stats.overrunCycles = overrunCycles;
+    taskCount++;
+    return i;
+}
+
+// Gives an event-driven task a function that reports when the work it is
+// ready for arrived (cycle count), so its latency includes the time before
+// the scheduler noticed. Returns false if no task runs run
+bool setTaskReadyTime(_task_callback_t run, _task_ready_time_t getReadyTime) {
+    uint8_t i;
+    for (i = 0; i < taskCount; i++) {
+        if (tasks[i].run == run) {
+            tasks[i].getReadyTime = getReadyTime;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Keeps the current pass from ending in the idle hook, for tasks without a
+// ready function that left work for the next pass
+void requestSchedulerPass() {
+    passRequested = true;
+}
+
+// NULL to never sleep
+void setIdleHook(_task_callback_t hook) {
+    idleHook = hook;
+}
+
+// Runs one pass over the tasks
+void runScheduler() {
+    uint32_t passStart = getCycleCount();
+    uint32_t start, cycles, latency;
+    bool busy = false;
+    task* t;
+    uint8_t i;
+    passRequested = false;
+    for (i = 0; i < taskCount; i++) {
+        t = &tasks[i];
+        if (t->isReady != NULL) {
+            if (!t->isReady()) {
+                continue;
+            }
+            busy = true;
+        }
+        //a deferred task keeps the time it first became ready
+        if (t->deferred == 0) {
+            if (t->isReady == NULL) {
+                t->readySince = passStart;
+            }
+            else if (t->getReadyTime == NULL || !t->getReadyTime(&t->readySince)) {
+                t->readySince = getCycleCount();
+            }
+        }
+        start = getCycleCount();
+        if (start - passStart > SCHED_PASS_BUDGET && t->stats.priority > tasks[0].stats.priority
+                && t->deferred < SCHED_MAX_DEFERRALS) {
+            t->deferred++;
+            t->stats.deferrals++;
+            busy = true; // still has work, so this pass must not sleep
+            continue;
+        }
+        t->deferred = 0;
+        t->run();
+        cycles = getCycleCount() - start;
+        t->stats.runs++;
+        t->stats.totalCycles += cycles;
+        if (cycles > t->stats.maxCycles) {
+            t->stats.maxCycles = cycles;
+        }
+        if (t->stats.overrunCycles && cycles > t->stats.overrunCycles) {
+            t->stats.overruns++;
+        }
+        latency = start - t->readySince;
+        t->stats.totalLatency += latency;
+        if (latency > t->stats.maxLatency) {
+            t->stats.maxLatency = latency;
+        }
+    }
+    if (!busy && !passRequested && idleHook != NULL) {
+        idleCount++;
+        idleHook();
+    }
+}
+
+uint8_t getTaskCount() {
+    return taskCount;
+}
+
+bool getTaskStats(uint8_t index, taskStats* stats) {
+    if (index >= taskCount) {
+        return false;
+    }
+    *stats = tasks[index].stats;
+    return true;
+}
+
+// Passes that ended in the idle hook
+uint32_t getIdleCount() {
+    return idleCount;
+}
+
+void resetSchedulerStats() {
+    uint8_t i;
+    for (i = 0; i < taskCount; i++) {
+        tasks[i].stats.runs = 0;
+        tasks[i].stats.overruns = 0;
+        tasks[i].stats.maxCycles = 0;
+        tasks[i].stats.totalCycles = 0;
+        tasks[i].stats.maxLatency = 0;
+        tasks[i].stats.totalLatency = 0;
+        tasks[i].stats.deferrals = 0;
+    }
+    idleCount = 0;
+}
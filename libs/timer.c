@@ -10,7 +10,11 @@
 // System Clock:    40 MHz
 
 // Hardware configuration:
-// Timer 4
+// SysTick (1 ms tick, see initSysTimer1ms), the ISR only counts ticks and
+// the wheel catches up to millis() in runTimers() from the main loop
+// Timer 4 (free running, random32 only)
+// (none when built with TIMER_VIRTUAL_CLOCK, time then only moves when
+//  advanceTimerClock() is called)
 
 //-----------------------------------------------------------------------------
 // Device includes, defines, and assembler directives
@@ -20,138 +24,394 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "tm4c123gh6pm.h"
+#include "clock.h"
 #include "timer.h"
+#include "trace.h"
+
+// Hierarchical timing wheel: level 0 has one slot per ms, each level above
+// covers 64 slots of the one below, 5 levels reach 2^30 ms (12.4 days)
+// Longer delays are carried in extraMs and rescheduled when the wheel wraps
+#define WHEEL_BITS   6
+#define WHEEL_SIZE   (1 << WHEEL_BITS)
+#define WHEEL_MASK   (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 5
+#define WHEEL_RANGE  (1UL << (WHEEL_BITS * WHEEL_LEVELS))
+
+#define NO_TIMER     0xFF
+#define EXPIRING     WHEEL_LEVELS   // level of timers taken off the wheel this tick
+
+#if NUM_TIMERS >= NO_TIMER
+#error "NUM_TIMERS must be less than 255"
+#endif
+
+// Handles are the slot index plus a generation that changes every time the
+// slot is freed, so a stale handle can't stop somebody else's timer
+#define TIMER_SLOT(id)       ((id) & 0xFF)
+#define TIMER_GENERATION(id) ((id) >> 8)
+#define TIMER_HANDLE(i)      ((uint16_t)((timers[i].generation << 8) | (i)))
 
 //-----------------------------------------------------------------------------
 // Global variables
 //-----------------------------------------------------------------------------
 
-
-
 typedef struct {
     _tim_callback_t callback;
     void* context;
-    uint32_t exp_time;
-    uint32_t rem_time;
+    uint32_t expires;       // wheel time of the next expiry
+    uint32_t periodMs;      // delay to use on reload or restart
+    uint32_t extraMs;       // delay still to go after expires (> WHEEL_RANGE)
+    uint8_t next;           // slot list or free list
+    uint8_t prev;
+    uint8_t level;
+    uint8_t generation;
     bool reload;
     bool active;
-} timer_t;
+} timerEntry;  // not timer_t, which hosted libcs already define
+
+timerEntry timers[NUM_TIMERS];
+uint8_t wheel[WHEEL_LEVELS][WHEEL_SIZE];   // list heads
+uint8_t expiringTimers = NO_TIMER;         // due this tick, callbacks pending
+uint8_t freeTimer = NO_TIMER;
+uint32_t wheelTime = 0;                    // next ms tick to process
 
-timer_t timers[NUM_TIMERS];
+#ifdef TIMER_VIRTUAL_CLOCK
+uint32_t randomState = 1;
+#endif
 
 //-----------------------------------------------------------------------------
 // Subroutines
 //-----------------------------------------------------------------------------
 
-void initTimer() {
+// Links a timer into the wheel slot for its expiry time
+static void addToWheel(uint8_t i) {
+    uint32_t delta = timers[i].expires - wheelTime;
+    uint8_t level = 0;
+    uint8_t slot;
+    while (level < WHEEL_LEVELS - 1 && delta >= (1UL << (WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+    slot = (timers[i].expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    timers[i].level = level;
+    timers[i].prev = NO_TIMER;
+    timers[i].next = wheel[level][slot];
+    if (timers[i].next != NO_TIMER) {
+        timers[timers[i].next].prev = i;
+    }
+    wheel[level][slot] = i;
+}
+
+static void removeFromWheel(uint8_t i) {
+    uint8_t slot = (timers[i].expires >> (WHEEL_BITS * timers[i].level)) & WHEEL_MASK;
+    if (timers[i].prev != NO_TIMER) {
+        timers[timers[i].prev].next = timers[i].next;
+    }
+    else if (timers[i].level == EXPIRING) {
+        expiringTimers = timers[i].next;
+    }
+    else {
+        wheel[timers[i].level][slot] = timers[i].next;
+    }
+    if (timers[i].next != NO_TIMER) {
+        timers[timers[i].next].prev = timers[i].prev;
+    }
+}
+
+// Sets the expiry ms from now, splitting off what the wheel can't hold
+static void scheduleTimer(uint8_t i, uint32_t ms) {
+    if (ms == 0) {
+        ms = 1;
+    }
+    if (ms >= WHEEL_RANGE) {
+        timers[i].extraMs = ms - (WHEEL_RANGE - 1);
+        ms = WHEEL_RANGE - 1;
+    }
+    else {
+        timers[i].extraMs = 0;
+    }
+    timers[i].expires = wheelTime + ms - 1; // wheelTime itself is 1 ms away
+    addToWheel(i);
+}
+
+static void freeTimerSlot(uint8_t i) {
+    timers[i].active = false;
+    timers[i].generation++;
+    timers[i].next = freeTimer;
+    freeTimer = i;
+}
+
+static uint16_t startTimer(_tim_callback_t callback, uint32_t ms, void* context, bool reload) {
+    uint16_t id = INVALID_TIMER;
+    uint8_t i = freeTimer;
+    if (i != NO_TIMER) {
+        freeTimer = timers[i].next;
+        timers[i].callback = callback;
+        timers[i].context = context;
+        timers[i].periodMs = ms;
+        timers[i].reload = reload;
+        timers[i].active = true;
+        scheduleTimer(i, ms);
+        id = TIMER_HANDLE(i);
+    }
+    return id;
+}
+
+// Seconds to ms without wrapping (long leases)
+static uint32_t secondsToMs(uint32_t seconds) {
+    return (seconds > UINT32_MAX / 1000) ? UINT32_MAX : seconds * 1000;
+}
+
+static bool isTimerHandleValid(uint16_t id) {
+    uint8_t i = TIMER_SLOT(id);
+    return i < NUM_TIMERS && timers[i].active && timers[i].generation == TIMER_GENERATION(id);
+}
+
+// Moves every timer in a higher level slot down now that it is close
+static void cascadeTimers(uint8_t level, uint8_t slot) {
+    uint8_t i = wheel[level][slot];
+    uint8_t next;
+    wheel[level][slot] = NO_TIMER;
+    while (i != NO_TIMER) {
+        next = timers[i].next;
+        addToWheel(i);
+        i = next;
+    }
+}
+
+// Takes the timers due at the current wheel time off the wheel and moves
+// the wheel on by one ms. The due timers wait on their own list, so
+// callbacks can start and stop timers (even ones due in the same tick)
+// without seeing a half-processed slot
+static void advanceWheel() {
+    uint8_t index = wheelTime & WHEEL_MASK;
+    uint8_t level;
+    uint8_t slot;
     uint8_t i;
+    if (index == 0) {
+        for (level = 1; level < WHEEL_LEVELS; level++) {
+            slot = (wheelTime >> (WHEEL_BITS * level)) & WHEEL_MASK;
+            cascadeTimers(level, slot);
+            if (slot != 0) {
+                break;
+            }
+        }
+    }
+    expiringTimers = wheel[0][index];
+    wheel[0][index] = NO_TIMER;
+    for (i = expiringTimers; i != NO_TIMER; i = timers[i].next) {
+        timers[i].level = EXPIRING;
+    }
+    wheelTime++;
+}
+
+// Calls up to budget due timers, returns how many were called
+static uint8_t runExpiredTimers(uint8_t budget) {
+    uint8_t count = 0;
+    uint8_t i;
+    _tim_callback_t callback;
+    void* context;
+    uint16_t id;
+    while (count < budget && (i = expiringTimers) != NO_TIMER) {
+        expiringTimers = timers[i].next;
+        if (expiringTimers != NO_TIMER) {
+            timers[expiringTimers].prev = NO_TIMER;
+        }
+        if (timers[i].extraMs) {
+            scheduleTimer(i, timers[i].extraMs);
+            continue;
+        }
+        callback = timers[i].callback;
+        context = timers[i].context;
+        id = TIMER_HANDLE(i);
+        if (timers[i].reload) {
+            scheduleTimer(i, timers[i].periodMs);
+        }
+        else {
+            freeTimerSlot(i);
+        }
+        recordTrace(TRACE_TIMER_FIRE, 0, id, 0, 0, (uint32_t)(uintptr_t)callback);
+        (*callback)(context);
+        count++;
+    }
+    return count;
+}
+
+// Processes one ms of wheel time, calling everything that is due
+static void tickWheel() {
+    advanceWheel();
+    runExpiredTimers(NUM_TIMERS);
+}
+
+void initTimer() {
+    uint8_t i, j;
+#ifndef TIMER_VIRTUAL_CLOCK
     // Enable clocks
     SYSCTL_RCGCTIMER_R |= SYSCTL_RCGCTIMER_R4;
     _delay_cycles(3);
-    // Configure Timer 4 for 1 sec tick
+    // Configure Timer 4 as a free running counter for random32()
     TIMER4_CTL_R &= ~TIMER_CTL_TAEN;                 // turn-off timer before reconfiguring
     TIMER4_CFG_R = TIMER_CFG_32_BIT_TIMER;           // configure as 32-bit timer (A+B)
     TIMER4_TAMR_R = TIMER_TAMR_TAMR_PERIOD;          // configure for periodic mode (count down)
     TIMER4_TAILR_R = 40000000;                       // set load value (1 Hz rate)
     TIMER4_CTL_R |= TIMER_CTL_TAEN;                  // turn-on timer
-    TIMER4_IMR_R |= TIMER_IMR_TATOIM;                // turn-on interrupt
-    NVIC_EN2_R |= 1 << (INT_TIMER4A-80);             // turn-on interrupt 86 (TIMER4A)
-    for (i = 0; i < NUM_TIMERS; i++) {
+#endif
+    for (i = 0; i < WHEEL_LEVELS; i++) {
+        for (j = 0; j < WHEEL_SIZE; j++) {
+            wheel[i][j] = NO_TIMER;
+        }
+    }
+    freeTimer = NO_TIMER;
+    for (i = NUM_TIMERS; i-- > 0;) {
         timers[i].callback = NULL;
         timers[i].context = NULL;
-        timers[i].exp_time = 0;
-        timers[i].rem_time = 0;
-        timers[i].reload = false;
-        timers[i].active = false;
+        timers[i].generation = 0;
+        freeTimerSlot(i);
     }
+    expiringTimers = NO_TIMER;
+    wheelTime = millis();
 }
 
-uint8_t startOneshotTimer(_tim_callback_t callback, uint32_t seconds, void* context) {
-    uint8_t i = 0;
-    for (i = 0; i < NUM_TIMERS; i++) {
-        if (!timers[i].active) {
-            timers[i].exp_time = seconds;
-            timers[i].rem_time = seconds;
-            timers[i].callback = callback;
-            timers[i].context = context;
-            timers[i].reload = false;
-            timers[i].active = true;
-            return i;
-        }
+uint16_t startOneshotTimer(_tim_callback_t callback, uint32_t seconds, void* context) {
+    return startTimer(callback, secondsToMs(seconds), context, false);
+}
+
+uint16_t startPeriodicTimer(_tim_callback_t callback, uint32_t seconds, void* context) {
+    return startTimer(callback, secondsToMs(seconds), context, true);
+}
+
+uint16_t startOneshotTimerMs(_tim_callback_t callback, uint32_t ms, void* context) {
+    return startTimer(callback, ms, context, false);
+}
+
+uint16_t startPeriodicTimerMs(_tim_callback_t callback, uint32_t ms, void* context) {
+    return startTimer(callback, ms, context, true);
+}
+
+//stops timer by ID, returns success status
+bool stopTimer(uint16_t id) {
+    bool ok = isTimerHandleValid(id);
+    if (ok) {
+        removeFromWheel(TIMER_SLOT(id));
+        freeTimerSlot(TIMER_SLOT(id));
+    }
+    return ok;
+}
+
+// Starts the full delay over again
+bool restartTimer(uint16_t id) {
+    bool ok = isTimerHandleValid(id);
+    if (ok) {
+        removeFromWheel(TIMER_SLOT(id));
+        scheduleTimer(TIMER_SLOT(id), timers[TIMER_SLOT(id)].periodMs);
+    }
+    return ok;
+}
+
+// Brings the wheel up to millis() and calls the timers that are due, at
+// most TIMER_CALLBACK_BUDGET per call so a burst of expiries can't starve
+// the rest of the main loop. Whatever is left runs on the next call
+// Callbacks only ever run here, never from an interrupt
+void runTimers() {
+    uint8_t budget = TIMER_CALLBACK_BUDGET;
+    budget -= runExpiredTimers(budget);
+    while (budget > 0 && expiringTimers == NO_TIMER && (int32_t)(millis() - wheelTime) > 0) {
+        advanceWheel();
+        budget -= runExpiredTimers(budget);
     }
-    return INVALID_TIMER;
 }
 
-uint8_t startPeriodicTimer(_tim_callback_t callback, uint32_t seconds, void* context) {
-    uint8_t i = 0;
+// True if runTimers() has callbacks to make or ticks to catch up on
+bool isTimerPending() {
+    return expiringTimers != NO_TIMER || (int32_t)(millis() - wheelTime) > 0;
+}
+
+#ifndef TIMER_VIRTUAL_CLOCK
+
+// Placeholder random number function
+uint32_t random32() {
+    return TIMER4_TAV_R;
+}
+
+#else
+
+// Wheel time of the earliest expiry (intermediate stops of long timers
+// count), false if no timers are running
+static bool getTimerExpiry(uint32_t* expires) {
+    bool found = false;
+    uint8_t i;
     for (i = 0; i < NUM_TIMERS; i++) {
-        if (!timers[i].active) {
-            timers[i].exp_time = seconds;
-            timers[i].rem_time = seconds;
-            timers[i].callback = callback;
-            timers[i].context = context;
-            timers[i].reload = true;
-            timers[i].active = true;
-            return i;
+        if (timers[i].active && (!found || (int32_t)(timers[i].expires - *expires) < 0)) {
+            *expires = timers[i].expires;
+            found = true;
         }
     }
-    return INVALID_TIMER;
+    return found;
 }
 
-//stops timer by ID, returns success status
-bool stopTimer(uint8_t id) {
-    if (id < NUM_TIMERS) {
-        if (timers[id].active) {
-            timers[id].rem_time = 0;
-            timers[id].active = 0;
-            return true;
+// Skips the wheel to a time before any expiry, timers are re-linked since
+// the cascades in between never ran
+static void jumpWheel(uint32_t time) {
+    uint8_t i, j;
+    for (i = 0; i < WHEEL_LEVELS; i++) {
+        for (j = 0; j < WHEEL_SIZE; j++) {
+            wheel[i][j] = NO_TIMER;
+        }
+    }
+    wheelTime = time;
+    for (i = 0; i < NUM_TIMERS; i++) {
+        if (timers[i].active) {
+            addToWheel(i);
         }
     }
-    return false;
 }
 
-bool restartTimer(uint8_t id) {
-    if (id < NUM_TIMERS) {
-        if (timers[id].active) {
-            timers[id].rem_time = timers[id].exp_time;
-            return true;
+// Moves virtual time (and millis()) forward by ms, calling timers as their
+// deadlines are crossed. Jumps from deadline to deadline, so a day of
+// protocol timeouts costs a handful of passes over the timer table
+void advanceTimerClock(uint32_t ms) {
+    uint32_t end = wheelTime + ms;
+    uint32_t expires;
+    while ((int32_t)(end - wheelTime) > 0) {
+        if (!getTimerExpiry(&expires) || (int32_t)(expires - end) >= 0) {
+            systime += end - wheelTime;
+            jumpWheel(end);
+            return;
+        }
+        systime += expires - wheelTime + 1;
+        if (expires != wheelTime) {
+            jumpWheel(expires);
         }
+        tickWheel();
     }
-    return false;
 }
 
-/*bool restartTimer(_callback callback) {
-     uint8_t i = 0;
-     bool found = false;
-     while (i < NUM_TIMERS && !found) {
-         found = fn[i] == callback;
-         if (found) {
-             ticks[i] = period[i];
-         }
-         i++;
-     }
-     return found;
-}*/
+// Returns ms until the next timer expires, false if none are running
+bool getNextTimerDeadline(uint32_t* ms) {
+    uint32_t expires;
+    if (!getTimerExpiry(&expires)) {
+        return false;
+    }
+    *ms = expires - wheelTime + 1;
+    return true;
+}
 
-// 1 second ticks
-void tickIsr() {
-    uint8_t i;
-    for (i = 0; i < NUM_TIMERS; i++) {
-        if (timers[i].rem_time != 0) {
-            timers[i].rem_time--;
-            if (timers[i].rem_time == 0) {
-                if (timers[i].reload) {
-                    timers[i].rem_time = timers[i].exp_time;
-                }
-                (*timers[i].callback)(timers[i].context);
-            }
-        }
+// Jumps straight to the next deadline, returns the ms skipped (0 if idle)
+uint32_t runToNextTimer() {
+    uint32_t ms;
+    if (!getNextTimerDeadline(&ms)) {
+        return 0;
     }
-    TIMER4_ICR_R = TIMER_ICR_TATOCINT;
+    advanceTimerClock(ms);
+    return ms;
 }
 
-// Placeholder random number function
+void seedRandom32(uint32_t seed) {
+    randomState = seed;
+}
+
+// Repeatable sequence so runs can be replayed
 uint32_t random32() {
-    return TIMER4_TAV_R;
+    randomState = randomState * 1664525 + 1013904223;
+    return randomState;
 }
 
+#endif
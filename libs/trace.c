@@ -0,0 +1,113 @@
+/******************************************************************************
+ * File:        trace.c
+ *
+ * Author:      Giancarlo Perez
+ *
+ * Created:     10/17/26
+ *
+ * Description: Event trace ring. Every event is recorded from the main loop
+ *              (timer callbacks included), so there is a single writer and
+ *              the ring needs no locking. The oldest events are overwritten
+ ******************************************************************************/
+
+//=============================================================================
+// INCLUDES
+//=============================================================================
+
+#include "trace.h"
+#include "clock.h"
+#include "ip.h"
+#include "arp.h"
+#include "tcp.h"
+#include "udp.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+//=============================================================================
+// DEFINES AND MACROS
+//=============================================================================
+
+#define TRACE_MASK (TRACE_SIZE - 1)
+
+#define TCP_TRACE_FLAGS (FIN | SYN | RST | PSH | ACK)
+
+//=============================================================================
+// TYPEDEFS AND GLOBALS
+//=============================================================================
+
+traceEvent traceRing[TRACE_SIZE];
+uint32_t traceTotal = 0;    // events ever recorded, next slot is traceTotal & TRACE_MASK
+
+//=============================================================================
+// PUBLIC FUNCTIONS
+//=============================================================================
+
+void recordTrace(uint8_t type, uint8_t a, uint16_t b, uint16_t c, uint16_t d, uint32_t e) {
+    traceEvent* ev = &traceRing[traceTotal & TRACE_MASK];
+    ev->time = millis();
+    ev->type = type;
+    ev->a = a;
+    ev->b = b;
+    ev->c = c;
+    ev->d = d;
+    ev->e = e;
+    traceTotal++;
+}
+
+// Pulls protocol, ports and remote address out of a frame about to be sent
+// (TRACE_TX_FRAME) or just received (TRACE_RX_FRAME)
+void recordTraceFrame(uint8_t type, etherHeader* ether, uint16_t size) {
+    ipHeader* ip = (ipHeader*)ether->data;
+    arpPacket* arp = (arpPacket*)ether->data;
+    tcpHeader* tcp;
+    udpHeader* udp;
+    uint16_t etherType = ntohs(ether->frameType);
+    uint16_t length = size & TRACE_LENGTH_MASK;
+    if (etherType == TYPE_IP) {
+        uint8_t* remote = (type == TRACE_TX_FRAME) ? ip->destIp : ip->sourceIp;
+        uint16_t sourcePort = 0, destPort = 0;
+        if (ip->protocol == PROTOCOL_TCP) {
+            tcp = (tcpHeader*)((uint8_t*)ip + ip->size * 4);
+            sourcePort = ntohs(tcp->sourcePort);
+            destPort = ntohs(tcp->destPort);
+            length |= (ntohs(tcp->offsetFields) & TCP_TRACE_FLAGS) << TRACE_FLAGS_SHIFT;
+        }
+        else if (ip->protocol == PROTOCOL_UDP) {
+            udp = (udpHeader*)((uint8_t*)ip + ip->size * 4);
+            sourcePort = ntohs(udp->sourcePort);
+            destPort = ntohs(udp->destPort);
+        }
+        recordTrace(type, ip->protocol, length, sourcePort, destPort, convertIpAddressToU32(remote));
+    }
+    else if (etherType == TYPE_ARP) {
+        recordTrace(type, 0, length, etherType, ntohs(arp->op),
+                    convertIpAddressToU32((type == TRACE_TX_FRAME) ? arp->destIp : arp->sourceIp));
+    }
+    else {
+        recordTrace(type, 0, length, etherType, 0, 0);
+    }
+}
+
+// Events currently held
+uint16_t getTraceCount() {
+    return (traceTotal < TRACE_SIZE) ? traceTotal : TRACE_SIZE;
+}
+
+// Events recorded since the last clear, anything past TRACE_SIZE was lost
+uint32_t getTraceTotal() {
+    return traceTotal;
+}
+
+// Index 0 is the oldest event held
+bool getTraceEvent(uint16_t index, traceEvent* event) {
+    uint16_t count = getTraceCount();
+    if (index >= count) {
+        return false;
+    }
+    *event = traceRing[(traceTotal - count + index) & TRACE_MASK];
+    return true;
+}
+
+void clearTrace() {
+    traceTotal = 0;
+}
@@ -15,9 +15,13 @@
 #include "uart0.h"
 #include "arp.h"
 #include "ip.h"
+#include "netif.h"
 #include "timer.h"
+#include "trace.h"
+#include "clock.h"
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 
 //=============================================================================
 // DEFINES AND MACROS
@@ -25,33 +29,255 @@
 
 #define ARP_RETRY_SECONDS 1
 #define MAX_ARP_ATTEMPTS 3
-#define MAX_ARP_REQUESTS 5
+
+#define ARP_NO_ENTRY 0xFF
+
+// Fibonacci hash, the varying last octet lands in the top byte of the key
+#define ARP_HASH(ip) ((uint8_t)(((ip) * 2654435761u) >> (32 - ARP_HASH_BITS)))
 
 //=============================================================================
 // GLOBALS
 //=============================================================================
 
 arp_entry_t arpTable[MAX_ARP_ENTRIES];
+uint8_t arpBuckets[ARP_HASH_SIZE];
+uint8_t arpFreeEntry = ARP_NO_ENTRY;
 uint8_t arpTableSize = 0;
-arpRequest arpReqs[MAX_ARP_REQUESTS];
-uint8_t arpReqsSize = 0;
+uint16_t arpAgingTimer = INVALID_TIMER;
+
+typedef struct _arpPendingFrame {
+    uint32_t ipAddress;         // next hop, 0 = slot free
+    uint16_t size;
+    uint16_t seq;               // queue order
+    _arp_callback_t failed;
+    void* ctxt;
+    uint8_t data[ARP_PENDING_FRAME_SIZE];
+} arpPendingFrame;
+
+arpPendingFrame arpPending[ARP_PENDING_FRAMES];
+uint16_t arpPendingSeq = 0;
+arpStats arpStat;
+arpRequest arpReqs[MAX_ARP_REQUESTS];   // slots never move, timers hold pointers to them
 
 //=============================================================================
 // STATIC FUNCTIONS
 //=============================================================================
 
+static uint8_t findArpEntry(uint32_t ip) {
+    uint8_t i = arpBuckets[ARP_HASH(ip)];
+    while (i != ARP_NO_ENTRY && arpTable[i].ipAddress != ip) {
+        i = arpTable[i].next;
+    }
+    return i;
+}
+
+static void freeArpEntry(uint8_t i) {
+    uint8_t* link = &arpBuckets[ARP_HASH(arpTable[i].ipAddress)];
+    while (*link != i) {
+        link = &arpTable[*link].next;
+    }
+    *link = arpTable[i].next;
+    arpTable[i].state = ARP_FREE;
+    arpTable[i].next = arpFreeEntry;
+    arpFreeEntry = i;
+    arpTableSize--;
+}
+
+// Picks the entry to give up when the table is full: one that was never
+// looked up, then a stale one, then the least recently used. Entries that
+// have been looked up are only taken when evictUsed is set
+static uint8_t findArpVictim(uint32_t now, bool evictUsed) {
+    uint8_t i, rank, victim = ARP_NO_ENTRY, victimRank = 0;
+    uint32_t age, victimAge = 0;
+    for (i = 0; i < MAX_ARP_ENTRIES; i++) {
+        if (arpTable[i].used == 0) {
+            rank = 3;
+            age = now - arpTable[i].updated;
+        }
+        else if (!evictUsed) {
+            continue;
+        }
+        else {
+            rank = (arpTable[i].state == ARP_STALE) ? 2 : 1;
+            age = now - arpTable[i].used;
+        }
+        if (rank > victimRank || (rank == victimRank && age > victimAge)) {
+            victim = i;
+            victimRank = rank;
+            victimAge = age;
+        }
+    }
+    return victim;
+}
+
+// Takes a free entry, or evicts one (see findArpVictim) when the table is
+// full. Returns ARP_NO_ENTRY if nothing could be evicted
+static uint8_t allocArpEntry(uint32_t ip, bool evictUsed) {
+    uint8_t i;
+    uint32_t now = millis();
+    if (arpFreeEntry == ARP_NO_ENTRY) {
+        i = findArpVictim(now, evictUsed);
+        if (i == ARP_NO_ENTRY) {
+            return ARP_NO_ENTRY;
+        }
+        freeArpEntry(i);
+    }
+    i = arpFreeEntry;
+    arpFreeEntry = arpTable[i].next;
+    arpTable[i].ipAddress = ip;
+    arpTable[i].updated = now;
+    arpTable[i].used = 0;
+    arpTable[i].probes = 0;
+    arpTable[i].next = arpBuckets[ARP_HASH(ip)];
+    arpBuckets[ARP_HASH(ip)] = i;
+    arpTableSize++;
+    return i;
+}
+
+// Asks a host in use for its MAC directly before its entry goes stale, so
+// sends to it never have to wait on a broadcast request
+static void refreshArpEntry(uint8_t i, uint32_t now) {
+    uint8_t ether[sizeof(etherHeader) + sizeof(arpPacket)];
+    uint8_t localIp[IP_ADD_LENGTH];
+    uint8_t ip[IP_ADD_LENGTH];
+    uint8_t j;
+    //in use means looked up since it was last confirmed, and recently
+    if (arpTable[i].used == 0 || (int32_t)(arpTable[i].used - arpTable[i].updated) <= 0
+            || now - arpTable[i].used >= ARP_REFRESH_IDLE_SECONDS * 1000u
+            || now - arpTable[i].updated < (ARP_REACHABLE_SECONDS - ARP_REFRESH_SECONDS) * 1000u
+            || arpTable[i].probes >= ARP_REFRESH_PROBES) {
+        return;
+    }
+    for (j = 0; j < IP_ADD_LENGTH; j++) {
+        ip[j] = arpTable[i].ipAddress >> (j * 8);
+    }
+    getIpAddress(localIp);
+    arpTable[i].probes++;
+    arpStat.refreshes++;
+    sendArpRequestTo((etherHeader*)ether, localIp, ip, arpTable[i].macAddress);
+}
+
+// Moves confirmed entries to stale and drops the ones nobody confirmed since.
+// An entry whose last refresh request went a whole pass without a reply is
+// dropped too, so the next send to it resolves again by broadcast
+static void arpAgingCallback(void* c) {
+    uint8_t i;
+    uint32_t now = millis();
+    (void)c;
+    for (i = 0; i < MAX_ARP_ENTRIES; i++) {
+        if ((arpTable[i].state == ARP_REACHABLE || arpTable[i].state == ARP_STALE)
+                && arpTable[i].probes >= ARP_REFRESH_PROBES) {
+            freeArpEntry(i);
+            arpStat.refreshFailed++;
+            continue;
+        }
+        if (arpTable[i].state == ARP_REACHABLE || arpTable[i].state == ARP_STALE) {
+            refreshArpEntry(i, now);
+        }
+        if (arpTable[i].state == ARP_REACHABLE && now - arpTable[i].updated >= ARP_REACHABLE_SECONDS * 1000u) {
+            arpTable[i].state = ARP_STALE;
+        }
+        else if (arpTable[i].state == ARP_STALE && now - arpTable[i].updated >= (ARP_REACHABLE_SECONDS + ARP_STALE_SECONDS) * 1000u) {
+            freeArpEntry(i);
+        }
+    }
+}
+
+// Hosts off the subnet are reached through the gateway
+static void getNextHop(uint8_t ipAdd[4], uint8_t nextHop[4]) {
+    uint8_t localIp[4];
+    uint8_t subnetMask[4];
+    getIpAddress(localIp);
+    getIpSubnetMask(subnetMask);
+    if (isIpInSubnet(localIp, ipAdd, subnetMask)) {
+        copyIpAddress(nextHop, ipAdd);
+    }
+    else {
+        getIpGatewayAddress(nextHop);
+    }
+}
+
+// Oldest frame queued for ip, or ARP_PENDING_FRAMES if none
+static uint8_t findPendingFrame(uint32_t ip) {
+    uint8_t i, oldest = ARP_PENDING_FRAMES;
+    for (i = 0; i < ARP_PENDING_FRAMES; i++) {
+        if (arpPending[i].ipAddress == ip && (oldest == ARP_PENDING_FRAMES
+                || (int16_t)(arpPending[i].seq - arpPending[oldest].seq) < 0)) {
+            oldest = i;
+        }
+    }
+    return oldest;
+}
+
+// Sends (or drops on failure) everything queued for the resolved next hop
+static void arpPendingCallback(arpRespContext resp) {
+    uint32_t ip = convertIpAddressToU32(resp.remoteIpAddress);
+    arpPendingFrame* f;
+    uint8_t i;
+    while ((i = findPendingFrame(ip)) != ARP_PENDING_FRAMES) {
+        f = &arpPending[i];
+        f->ipAddress = 0;
+        if (resp.success) {
+            copyMacAddress(((etherHeader*)f->data)->destAddress, resp.responseMacAddress);
+            putNetifPacket((etherHeader*)f->data, f->size);
+            arpStat.pendingSent++;
+        }
+        else {
+            arpStat.pendingTimeouts++;
+            if (f->failed) {
+                resp.ctxt = f->ctxt;
+                f->failed(resp);
+            }
+        }
+    }
+}
+
+static arpRequest* findArpRequest(uint8_t ipAdd[4]) {
+    uint8_t i;
+    for (i = 0; i < MAX_ARP_REQUESTS; i++) {
+        if (arpReqs[i].arpTimer != INVALID_TIMER && isIpEqual(arpReqs[i].ipAdd, ipAdd)) {
+            return &arpReqs[i];
+        }
+    }
+    return NULL;
+}
+
+// Frees the request and tells everyone waiting on it. The slot is released
+// first so callbacks can start new requests
+static void completeArpRequest(arpRequest* arpReq, arpRespContext resp) {
+    arpWaiter waiters[MAX_ARP_WAITERS];
+    uint8_t i, count = arpReq->waiterCount;
+    stopTimer(arpReq->arpTimer);
+    arpReq->arpTimer = INVALID_TIMER;
+    memcpy(waiters, arpReq->waiters, sizeof(arpWaiter) * count);
+    copyIpAddress(resp.remoteIpAddress, arpReq->ipAdd);
+    for (i = 0; i < count; i++) {
+        resp.ctxt = waiters[i].ctxt;
+        waiters[i].callback(resp);
+    }
+}
+
+// Stores a MAC we know is current and hands it to anyone waiting on it
+static void confirmArpEntry(uint8_t ipAddress[], uint8_t macAddress[]) {
+    arpRequest* arpReq;
+    addArpEntry(ipAddress, macAddress); //adds or refreshes the entry
+    arpReq = findArpRequest(ipAddress);
+    if (arpReq) { //every waiter gets the MAC
+        arpRespContext resp;
+        resp.success = 1;
+        copyMacAddress(resp.responseMacAddress, macAddress);
+        completeArpRequest(arpReq, resp); //if target ip is external, response mac address will be router
+    }
+}
+
 static void arpTimeoutCallback(void* c) {
     arpRequest* arpReq = (arpRequest*)c;
     arpReq->attempts++;
     if (arpReq->attempts == MAX_ARP_ATTEMPTS) {
-        arpReq->attempts = 0;
-        stopTimer(arpReq->arpTimer);
+        removeArpEntry(arpReq->ipAdd);
         arpRespContext resp;
-        resp.success = 0;
-        resp.ctxt = arpReq->ctxt;
-        if (arpReq->callback) {
-            arpReq->callback(resp); //mac address invalid
-        }
+        resp.success = 0; //mac address invalid
+        completeArpRequest(arpReq, resp);
     }
     else {
         //Nth arp attempt...
@@ -66,19 +292,40 @@ static void arpTimeoutCallback(void* c) {
 // PUBLIC FUNCTIONS
 //=============================================================================
 
+void initArp() {
+    uint8_t i;
+    clearArpTable();
+    for (i = 0; i < MAX_ARP_REQUESTS; i++) {
+        arpReqs[i].arpTimer = INVALID_TIMER;
+    }
+    if (arpAgingTimer == INVALID_TIMER) {
+        arpAgingTimer = startPeriodicTimer(arpAgingCallback, ARP_AGING_SECONDS, NULL);
+    }
+}
+
 void displayArpTable() {
+    static const char* states[] = {"", "incomplete", "reachable", "stale"};
     putsUart0("\nARP Cache\n------------------------------------------------------------\n");
-    putsUart0(" IP Address                  MAC Address\n");
-    uint8_t i;
+    putsUart0(" IP Address        MAC Address         State       Age (s)\n");
+    uint8_t i, j;
+    uint8_t ip[IP_ADD_LENGTH];
     for (i = 0; i < MAX_ARP_ENTRIES; i++) {
-        if (arpTable[i].valid) {
-            uint8_t* ip = arpTable[i].ipAddress;
+        if (arpTable[i].state != ARP_FREE) {
             uint8_t* mac = arpTable[i].macAddress;
             char ipStr[16];
             char macStr[18];
+            for (j = 0; j < IP_ADD_LENGTH; j++) {
+                ip[j] = arpTable[i].ipAddress >> (j * 8);
+            }
             snprintf(ipStr, 16, "%d.%d.%d.%d", ip[0], ip[1], ip[2], ip[3]);
-            snprintf(macStr, 18, "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-            snprintf(out, MAX_UART_OUT, " %-28s%-20s\n", ipStr, macStr);
+            if (arpTable[i].state == ARP_INCOMPLETE) {
+                snprintf(macStr, 18, "-");
+            }
+            else {
+                snprintf(macStr, 18, "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+            }
+            snprintf(out, MAX_UART_OUT, " %-18s%-20s%-12s%lu\n", ipStr, macStr, states[arpTable[i].state],
+                     (unsigned long)((millis() - arpTable[i].updated) / 1000));
             putsUart0(out);
         }
     }
@@ -87,35 +334,57 @@ void displayArpTable() {
 
 void clearArpTable() {
     uint8_t i;
+    for (i = 0; i < ARP_HASH_SIZE; i++) {
+        arpBuckets[i] = ARP_NO_ENTRY;
+    }
     for (i = 0; i < MAX_ARP_ENTRIES; i++) {
-        arpTable[i].valid = 0;
-        arpTableSize = 0;
+        arpTable[i].state = ARP_FREE;
+        arpTable[i].next = (i + 1 < MAX_ARP_ENTRIES) ? i + 1 : ARP_NO_ENTRY;
     }
+    arpFreeEntry = 0;
+    arpTableSize = 0;
 }
 
+// Adds or refreshes the entry for ipAddress, evicting another entry if the
+// table is full
 void addArpEntry(uint8_t ipAddress[], uint8_t macAddress[]) {
-    //O(1) complexity
-    arp_entry_t* entry = &arpTable[arpTableSize++];
-    copyIpAddress(entry->ipAddress, ipAddress);
-    copyMacAddress(entry->macAddress, macAddress);
-    entry->valid = 1;
+    uint32_t ip = convertIpAddressToU32(ipAddress);
+    uint8_t i = findArpEntry(ip);
+    if (i == ARP_NO_ENTRY) {
+        i = allocArpEntry(ip, true);
+    }
+    else if (arpTable[i].probes) {
+        arpStat.refreshed++;
+    }
+    copyMacAddress(arpTable[i].macAddress, macAddress);
+    arpTable[i].state = ARP_REACHABLE;
+    arpTable[i].updated = millis();
+    arpTable[i].probes = 0;
 }
 
-//writes to mac address, returns NULL If no entry
+//writes to mac address, returns 0 if no entry
 uint8_t lookupArpEntry(uint8_t ipAddress[], uint8_t macAddressToWrite[]) {
-    uint8_t i;
-    //O(1) best case
-    //O(N) worst case
-    for (i = 0; i < arpTableSize; i++) {
-        if (isIpEqual(arpTable[i].ipAddress, ipAddress)) {
-            //found given IP in ARP table
-            if (macAddressToWrite) {
-                copyMacAddress(macAddressToWrite, arpTable[i].macAddress);
-            }
-            return 1;
-        }
+    uint8_t i = findArpEntry(convertIpAddressToU32(ipAddress));
+    if (i == ARP_NO_ENTRY || arpTable[i].state == ARP_INCOMPLETE) {
+        return 0;  // No entry found for the given IP address
+    }
+    arpTable[i].used = millis();
+    if (macAddressToWrite) {
+        copyMacAddress(macAddressToWrite, arpTable[i].macAddress);
+    }
+    return 1;
+}
+
+void removeArpEntry(uint8_t ipAddress[]) {
+    uint8_t i = findArpEntry(convertIpAddressToU32(ipAddress));
+    if (i != ARP_NO_ENTRY) {
+        freeArpEntry(i);
     }
-    return NULL;  // No entry found for the given IP address
+}
+
+// Entries in use, including incomplete ones
+uint8_t getArpEntryCount() {
+    return arpTableSize;
 }
 
 arpPacket* getArpPacket(etherHeader* ether) {
@@ -148,58 +417,164 @@ void arpResolutionCallback(arpRespContext resp) {
 //ctxt must consist between loops, essentially must be a global
 void resolveMacAddress(uint8_t ipAdd[4], _arp_callback_t cb, void* ctxt) {
     uint8_t localIp[4];
-    uint8_t subnetMask[4];
-    uint8_t gateway[4];
+    uint8_t nextHop[4];
     uint8_t remoteMac[6];
     getIpAddress(localIp);
-    getIpSubnetMask(subnetMask);
-    getIpGatewayAddress(gateway);
-    bool isIpLocal = isIpInSubnet(localIp, ipAdd, subnetMask);
-    uint8_t arpEntryExists = lookupArpEntry(isIpLocal ? ipAdd : gateway, remoteMac);
+    getNextHop(ipAdd, nextHop); //arp does not care about the external IP just the requested one
+    uint8_t arpEntryExists = lookupArpEntry(nextHop, remoteMac);
     if (arpEntryExists) {
         arpRespContext resp;
         resp.success = 1;
+        copyIpAddress(resp.remoteIpAddress, nextHop);
         copyMacAddress(resp.responseMacAddress, remoteMac); //return MAC if exists in table
         resp.ctxt = ctxt;
         cb(resp);
     }
     else {
         uint8_t ether[MAX_PACKET_SIZE];
-        arpRequest req;
-        copyIpAddress(req.ipAdd, isIpLocal ? ipAdd : gateway); //if local use local IP otherwise target is gateway, this will make line 178 work. arp does not care aobut the external IP just the requested one
-        req.callback = cb;
-        req.attempts = 0;
-        req.arpTimer = startPeriodicTimer(arpTimeoutCallback, ARP_RETRY_SECONDS, &arpReqs[arpReqsSize]); //wait 3 seconds for arp
-        req.ctxt = ctxt;
-        arpReqs[arpReqsSize++] = req; //add req to list
-        sendArpRequest((etherHeader*)ether, localIp, isIpLocal ? ipAdd : gateway); //if IP is in same subnet, send ARP for that IP, else send ARP to gateway
+        arpRequest* req = findArpRequest(nextHop);
+        uint8_t i;
+        if (req && req->waiterCount < MAX_ARP_WAITERS) {
+            //already asking for this address, wait on that request
+            req->waiters[req->waiterCount].callback = cb;
+            req->waiters[req->waiterCount++].ctxt = ctxt;
+            arpStat.coalesced++;
+            return;
+        }
+        for (i = 0; i < MAX_ARP_REQUESTS && !req; i++) {
+            if (arpReqs[i].arpTimer == INVALID_TIMER) {
+                req = &arpReqs[i];
+            }
+        }
+        if (req && req->arpTimer == INVALID_TIMER
+                && (req->arpTimer = startPeriodicTimer(arpTimeoutCallback, ARP_RETRY_SECONDS, req)) != INVALID_TIMER) {
+            copyIpAddress(req->ipAdd, nextHop);
+            req->attempts = 0;
+            req->waiterCount = 1;
+            req->waiters[0].callback = cb;
+            req->waiters[0].ctxt = ctxt;
+            arpStat.requests++;
+            if (findArpEntry(convertIpAddressToU32(nextHop)) == ARP_NO_ENTRY) {
+                i = allocArpEntry(convertIpAddressToU32(nextHop), true);
+                arpTable[i].state = ARP_INCOMPLETE;
+                arpTable[i].used = millis(); //someone is about to send to it
+            }
+            sendArpRequest((etherHeader*)ether, localIp, nextHop);
+        }
+        else {
+            //no room to track another request or waiter
+            arpRespContext resp;
+            resp.success = 0;
+            copyIpAddress(resp.remoteIpAddress, nextHop);
+            resp.ctxt = ctxt;
+            cb(resp);
+        }
+    }
+}
+
+// Writes the MAC of the next hop towards ipAdd if it is already known
+bool lookupArpNextHop(uint8_t ipAdd[4], uint8_t macAddressToWrite[]) {
+    uint8_t nextHop[4];
+    getNextHop(ipAdd, nextHop);
+    return lookupArpEntry(nextHop, macAddressToWrite);
+}
+
+// Takes a frame that is complete apart from the destination MAC and sends it
+// once the next hop towards ipAdd is resolved. failed (optional) is called
+// with ctxt if it is dropped because resolution timed out. Returns false if
+// the frame could not be queued
+bool queueArpFrame(uint8_t ipAdd[4], etherHeader* ether, uint16_t size, _arp_callback_t failed, void* ctxt) {
+    uint8_t nextHop[4];
+    uint8_t i, count = 0, slot = ARP_PENDING_FRAMES;
+    uint32_t ip;
+    arpPendingFrame* f;
+    getNextHop(ipAdd, nextHop);
+    ip = convertIpAddressToU32(nextHop);
+    if (size > ARP_PENDING_FRAME_SIZE || ip == 0) {
+        arpStat.pendingOverflows++;
+        return false;
+    }
+    for (i = 0; i < ARP_PENDING_FRAMES; i++) {
+        if (arpPending[i].ipAddress == ip) {
+            count++;
+        }
+        else if (arpPending[i].ipAddress == 0) {
+            slot = i;
+        }
+    }
+    if (count >= ARP_PENDING_PER_HOST) {
+        slot = findPendingFrame(ip); //make room by dropping this host's oldest
+        arpStat.pendingOverflows++;
+    }
+    else if (slot == ARP_PENDING_FRAMES) {
+        arpStat.pendingOverflows++;
+        return false;
     }
+    f = &arpPending[slot];
+    f->ipAddress = ip;
+    f->size = size;
+    f->seq = arpPendingSeq++;
+    f->failed = failed;
+    f->ctxt = ctxt;
+    memcpy(f->data, ether, size);
+    arpStat.pendingQueued++;
+    if (count == 0) {
+        resolveMacAddress(nextHop, arpPendingCallback, NULL); //later frames ride on the same request
+    }
+    return true;
+}
+
+void getArpStats(arpStats* stats) {
+    *stats = arpStat;
 }
 
+// Only a reply to a request of ours may add an entry (and so evict one), any
+// other reply is treated like overheard traffic
 void processArpResponse(etherHeader* ether) {
-    uint8_t i, j;
     arpPacket* arp = getArpPacket(ether);
-    if (!lookupArpEntry(arp->sourceIp, NULL)) { //if entry DNE, add it
-        addArpEntry(arp->sourceIp, arp->sourceAddress);
+    uint8_t i = findArpEntry(convertIpAddressToU32(arp->sourceIp));
+    recordTrace(TRACE_ARP_RESPONSE, 0, 0, 0, 0, convertIpAddressToU32(arp->sourceIp));
+    if (findArpRequest(arp->sourceIp) != NULL || (i != ARP_NO_ENTRY && arpTable[i].state == ARP_INCOMPLETE)) {
+        confirmArpEntry(arp->sourceIp, arp->sourceAddress);
     }
-    for (i = 0; i < MAX_ARP_REQUESTS; i++) {
-        if (isIpEqual(arpReqs[i].ipAdd, arp->sourceIp)) { //if this response is a response to one of our requests, call the request callback
-            //found the arp request, stop timer;
-            stopTimer(arpReqs[i].arpTimer);
-            //respond with success code and resolved MAC along w context
-            arpRespContext resp;
-            resp.success = 1;
-            copyMacAddress(resp.responseMacAddress, arp->sourceAddress);
-            resp.ctxt = arpReqs[i].ctxt;
-            arpReqs[i].callback(resp); //application should also check??? if target ip is external, response mac address will be router;
-            //remove the request from the list
-            for (j = i; j < arpReqsSize - 1; j++) {
-                arpReqs[j] = arpReqs[j + 1];
-            }
-            arpReqsSize--;
-            break;
+    else {
+        learnArpEntry(arp->sourceIp, arp->sourceAddress, isIpEqual(arp->sourceIp, arp->destIp));
+    }
+}
+
+// Takes the sender of a frame we did not ask about. Only unicast hosts on our
+// subnet are kept, and unless create is set only ones already in the table
+// are refreshed
+void learnArpEntry(uint8_t ipAddress[], uint8_t macAddress[], bool create) {
+    uint8_t localIp[4];
+    uint8_t subnetMask[4];
+    uint32_t hostMask, host;
+    getIpAddress(localIp);
+    getIpSubnetMask(subnetMask);
+    hostMask = ~convertIpAddressToU32(subnetMask);
+    host = convertIpAddressToU32(ipAddress) & hostMask;
+    if ((macAddress[0] & 1) || !isIpValid(localIp) || !isIpInSubnet(localIp, ipAddress, subnetMask)
+            || isIpEqual(ipAddress, localIp) || host == 0 || host == hostMask) {
+        return;
+    }
+    if (findArpEntry(convertIpAddressToU32(ipAddress)) == ARP_NO_ENTRY) {
+        //a host we only overheard must never push out one we send to
+        if (!create || allocArpEntry(convertIpAddressToU32(ipAddress), false) == ARP_NO_ENTRY) {
+            return;
         }
+        arpStat.learned++;
     }
+    confirmArpEntry(ipAddress, macAddress);
+}
+
+// ARP requests for our address and gratuitous ARPs add the sender, requests
+// between other hosts only refresh it
+void learnArpSender(etherHeader* ether) {
+    arpPacket* arp = getArpPacket(ether);
+    uint8_t localIp[4];
+    getIpAddress(localIp);
+    learnArpEntry(arp->sourceIp, arp->sourceAddress,
+                  isIpEqual(arp->destIp, localIp) || isIpEqual(arp->sourceIp, arp->destIp));
 }
 
 // Determines whether packet is ARP response
@@ -221,7 +596,7 @@ void sendArpResponse(etherHeader *ether) {
     // set op to response
     arp->op = htons(2);
     // swap source and destination fields
-    getEtherMacAddress(localHwAddress);
+    getNetifMacAddress(localHwAddress);
     for (i = 0; i < HW_ADD_LENGTH; i++) {
         arp->destAddress[i] = arp->sourceAddress[i];
         ether->destAddress[i] = ether->sourceAddress[i];
@@ -233,7 +608,7 @@ void sendArpResponse(etherHeader *ether) {
         arp->sourceIp[i] = tmp;
     }
     // send packet
-    putEtherPacket(ether, sizeof(etherHeader) + sizeof(arpPacket));
+    putNetifPacket(ether, sizeof(etherHeader) + sizeof(arpPacket));
 }
 
 // Determines whether packet is ARP
@@ -255,15 +630,20 @@ bool isArpRequest(etherHeader* ether) {
 
 // Sends an ARP request
 void sendArpRequest(etherHeader *ether, uint8_t ipFrom[], uint8_t ipTo[]) {
+    sendArpRequestTo(ether, ipFrom, ipTo, BROADCAST_MAC_ADDRESS);
+}
+
+// Sends an ARP request to one host (refresh) instead of broadcasting it
+void sendArpRequestTo(etherHeader *ether, uint8_t ipFrom[], uint8_t ipTo[], const uint8_t macTo[]) {
     arpPacket *arp = (arpPacket*)ether->data;
     uint8_t i;
     uint8_t localHwAddress[HW_ADD_LENGTH];
 
     // fill ethernet frame
-    getEtherMacAddress(localHwAddress);
+    getNetifMacAddress(localHwAddress);
     for (i = 0; i < HW_ADD_LENGTH; i++) {
         ether->sourceAddress[i] = localHwAddress[i];
-        ether->destAddress[i] = 0xFF;
+        ether->destAddress[i] = macTo[i];
     }
     ether->frameType = htons(TYPE_ARP);
     // fill arp frame
@@ -274,12 +654,20 @@ void sendArpRequest(etherHeader *ether, uint8_t ipFrom[], uint8_t ipTo[]) {
     arp->op = htons(1);
     for (i = 0; i < HW_ADD_LENGTH; i++) {
         arp->sourceAddress[i] = localHwAddress[i];
-        arp->destAddress[i] = 0xFF;
+        arp->destAddress[i] = macTo[i];
     }
     for (i = 0; i < IP_ADD_LENGTH; i++) {
         arp->sourceIp[i] = ipFrom[i];
         arp->destIp[i] = ipTo[i];
     }
+    recordTrace(TRACE_ARP_REQUEST, 0, 0, 0, 0, convertIpAddressToU32(ipTo));
     // send packet
-    putEtherPacket(ether, sizeof(etherHeader) + sizeof(arpPacket));
+    putNetifPacket(ether, sizeof(etherHeader) + sizeof(arpPacket));
+}
+
+// Announces our address so peers update their caches without asking
+void sendGratuitousArp(etherHeader* ether) {
+    uint8_t localIp[IP_ADD_LENGTH];
+    getIpAddress(localIp);
+    sendArpRequest(ether, localIp, localIp);
 }
@@ -17,6 +17,8 @@
 #include "uart0.h"
 #include "arp.h"
 #include "dhcp.h"
+#include "netif.h"
+#include "trace.h"
 #include <stdio.h>
 
 //=============================================================================
@@ -46,21 +48,34 @@ uint8_t dhcpState = DHCP_DISABLED;
 bool    dhcpEnabled = true;
 
 // 7 Timers
-uint8_t t1PeriodicTimer;
-uint8_t t1HitTimer;
-uint8_t t2PeriodicTimer;
-uint8_t t2HitTimer;
-uint8_t leaseEndTimer;
-uint8_t arpTestTimer;
-uint8_t releaseTimer;
-uint8_t newAddTimer;
-uint8_t leaseTickTimer;
+uint16_t t1PeriodicTimer = INVALID_TIMER;
+uint16_t t1HitTimer = INVALID_TIMER;
+uint16_t t2PeriodicTimer = INVALID_TIMER;
+uint16_t t2HitTimer = INVALID_TIMER;
+uint16_t leaseEndTimer = INVALID_TIMER;
+uint16_t arpTestTimer = INVALID_TIMER;
+uint16_t releaseTimer = INVALID_TIMER;
+uint16_t newAddTimer = INVALID_TIMER;
+uint16_t leaseTickTimer = INVALID_TIMER;
+
+//=============================================================================
+// STATIC FUNCTIONS
+//=============================================================================
+
+// Stops a timer if it is still running and forgets its handle
+static void stopDhcpTimer(uint16_t* timer) {
+    if (*timer != INVALID_TIMER) {
+        stopTimer(*timer);
+        *timer = INVALID_TIMER;
+    }
+}
 
 //=============================================================================
 // PUBLIC FUNCTIONS
 //=============================================================================
 
 void setDhcpState(uint8_t state) {
+    recordTrace(TRACE_DHCP_STATE, state, 0, dhcpState, 0, 0);
     dhcpState = state;
 }
 
@@ -87,6 +102,7 @@ void callbackDhcpT1PeriodicTimer(void* c) {
 }
 
 void callbackDhcpT1HitTimer(void* c) {
+    t1HitTimer = INVALID_TIMER;
     putsUart0("DHCP: T1 Hit reached\n");
     setDhcpState(DHCP_RENEWING);
     t1PeriodicTimer = startPeriodicTimer(callbackDhcpT1PeriodicTimer, 15, NULL);
@@ -105,13 +121,16 @@ void callbackDhcpT2PeriodicTimer(void* c) {
 }
 
 void callbackDhcpT2HitTimer(void* c) {
-    stopTimer(t1PeriodicTimer);
+    t2HitTimer = INVALID_TIMER;
+    stopDhcpTimer(&t1PeriodicTimer);
     setDhcpState(DHCP_REBINDING);
     t2PeriodicTimer = startPeriodicTimer(callbackDhcpT2PeriodicTimer, 15, NULL);
 }
 
-// End of lease timer
+// End of lease timer, c points at the handle that fired (lease end or the
+// discover timeout)
 void callbackDhcpLeaseEndTimer(void* c) {
+    *(uint16_t*)c = INVALID_TIMER;
     releaseDhcp();
 }
 
@@ -122,12 +141,12 @@ void dhcpLeaseTick(void* c) {
 // Release functions
 void releaseDhcp() {
     putsUart0("DHCP: IP Address Released\n");
-    stopTimer(t1HitTimer);
-    stopTimer(t1PeriodicTimer);
-    stopTimer(t2HitTimer);
-    stopTimer(t2PeriodicTimer);
-    stopTimer(leaseEndTimer);
-    stopTimer(leaseTickTimer);
+    stopDhcpTimer(&t1HitTimer);
+    stopDhcpTimer(&t1PeriodicTimer);
+    stopDhcpTimer(&t2HitTimer);
+    stopDhcpTimer(&t2PeriodicTimer);
+    stopDhcpTimer(&leaseEndTimer);
+    stopDhcpTimer(&leaseTickTimer);
     if (getDhcpState() != DHCP_INIT) {
         releaseNeeded = true;
     }
@@ -151,14 +170,21 @@ void renewDhcp() {
     putsUart0("DHCP: IP Address acquired\n");
     setDhcpState(DHCP_BOUND);
     setIpAddress(dhcpOfferedIpAdd);
+    stopDhcpTimer(&t1HitTimer);
+    stopDhcpTimer(&t1PeriodicTimer);
+    stopDhcpTimer(&t2HitTimer);
+    stopDhcpTimer(&t2PeriodicTimer);
+    stopDhcpTimer(&leaseEndTimer);
+    stopDhcpTimer(&leaseTickTimer);
     t1HitTimer = startOneshotTimer(callbackDhcpT1HitTimer, leaseT1, NULL);
     t2HitTimer = startOneshotTimer(callbackDhcpT2HitTimer, leaseT2, NULL);
-    leaseEndTimer = startOneshotTimer(callbackDhcpLeaseEndTimer, leaseSeconds, NULL);
+    leaseEndTimer = startOneshotTimer(callbackDhcpLeaseEndTimer, leaseSeconds, &leaseEndTimer);
     leaseTickTimer = startPeriodicTimer(dhcpLeaseTick, 1, NULL);
 }
 
 // IP conflict detection
 void callbackDhcpIpConflictWindow(void* c) {
+    arpTestTimer = INVALID_TIMER;
     renewDhcp();
 }
 
@@ -188,10 +214,10 @@ uint32_t getDhcpLeaseSeconds() {
 // Must be a UDP packet
 bool isDhcpResponse(etherHeader* ether) {
     bool ok;
-    if (!isUdp(ether)) {
+    ipHeader *ip = (ipHeader*)ether->data;
+    if (ip->protocol != PROTOCOL_UDP) {
         return false;
     }
-    ipHeader *ip = (ipHeader*)ether->data;
     uint8_t ipHeaderLength = ip->size * 4;
     udpHeader *udp = (udpHeader*)((uint8_t*)ip + ipHeaderLength);
     ok = (udp->destPort == htons(DHCP_DEST_PORT_S));
@@ -257,12 +283,13 @@ void sendDhcpMessage(etherHeader* ether, uint8_t type) {
     uint8_t localIpAddress[4];
     uint8_t optionData[DHCP_MAX_OPTION_LENGTH];
     uint8_t state = getDhcpState();
-    getEtherMacAddress(localHwAddress);
+    getNetifMacAddress(localHwAddress);
     getIpAddress(localIpAddress);
 
     s.localPort = DHCP_SOURCE_PORT_C;
     s.remotePort = DHCP_DEST_PORT_C;
     copyMacAddress(s.remoteHwAddress, BROADCAST_MAC_ADDRESS);
+    invalidateSocketTxHeader(&s);
     switch (state) {
     case DHCP_REQUESTING:
     case DHCP_TESTING_IP:
@@ -350,7 +377,7 @@ bool isDhcpOffer(etherHeader* ether, uint8_t ipOfferedAdd[]) {
     bool ok;
     ok = (option[2] == DHCPOFFER) & (udp->sourcePort == DHCP_SOURCE_PORT_S);
     uint8_t localHwAddress[6];
-    getEtherMacAddress(localHwAddress);
+    getNetifMacAddress(localHwAddress);
     int i;
     for (i = 0; i < HW_ADD_LENGTH; i++) {
         ok = (dhcp->chaddr[i] == localHwAddress[i]); //if this returns false the offer is not to me
@@ -374,7 +401,7 @@ bool isDhcpAck(etherHeader* ether) {
     dhcpFrame* dhcp = (dhcpFrame*)((uint8_t*)udp->data);
     uint8_t* option = getDhcpOption(ether, DHCP_OPTION_DHCP_TYPE);
     uint8_t localHwAddress[6];
-    getEtherMacAddress(localHwAddress);
+    getNetifMacAddress(localHwAddress);
     ok = (option[2] == DHCPACK) & (udp->sourcePort == htons(DHCP_SOURCE_PORT_S));
     int i;
     for (i = 0; i < HW_ADD_LENGTH; i++) {
@@ -415,20 +442,20 @@ void handleDhcpAck(etherHeader *ether) {
     uint8_t state = getDhcpState();
     switch (state) {
     case DHCP_RENEWING:
-        stopTimer(t1PeriodicTimer);
-        stopTimer(t2HitTimer);
-        stopTimer(leaseEndTimer);
-        stopTimer(leaseTickTimer);
+        stopDhcpTimer(&t1PeriodicTimer);
+        stopDhcpTimer(&t2HitTimer);
+        stopDhcpTimer(&leaseEndTimer);
+        stopDhcpTimer(&leaseTickTimer);
         renewDhcp();
         break;
     case DHCP_REBINDING:
-        stopTimer(t2PeriodicTimer);
-        stopTimer(leaseEndTimer);
-        stopTimer(leaseTickTimer);
+        stopDhcpTimer(&t2PeriodicTimer);
+        stopDhcpTimer(&leaseEndTimer);
+        stopDhcpTimer(&leaseTickTimer);
         renewDhcp();
         break;
     case DHCP_REQUESTING:
-        stopTimer(releaseTimer);
+        stopDhcpTimer(&releaseTimer);
         if (isDhcpIpConflictDetectionMode()) {
             requestDhcpIpConflictTest(ether);
         }
@@ -473,7 +500,8 @@ void sendDhcpPendingMessages(etherHeader* ether) {
             sendDhcpMessage(ether, DHCPDISCOVER);
             putsUart0("DHCP: Sending DISCOVER...\n");
             setDhcpState(DHCP_SELECTING);
-            releaseTimer = startOneshotTimer(callbackDhcpLeaseEndTimer, 15, NULL); //calls releaseDhcp();
+            stopDhcpTimer(&releaseTimer);
+            releaseTimer = startOneshotTimer(callbackDhcpLeaseEndTimer, 15, &releaseTimer); //calls releaseDhcp();
         }
         break;
     case DHCP_SELECTING:
@@ -494,7 +522,7 @@ void sendDhcpPendingMessages(etherHeader* ether) {
         }
         if (isDhcpDiscoverNeeded()) {
             discoverNeeded = false;
-            stopTimer(newAddTimer);
+            stopDhcpTimer(&newAddTimer);
             sendDhcpMessage(ether, DHCPDISCOVER);
             setDhcpState(DHCP_INIT);
         }
@@ -572,8 +600,9 @@ void processDhcpArpResponse(etherHeader* ether) {
     if (getDhcpState() == DHCP_TESTING_IP) {
         if (isIpEqual(arp->sourceIp, dhcpOfferedIpAdd)) {
             //conflicting IP
-            stopTimer(arpTestTimer);
+            stopDhcpTimer(&arpTestTimer);
             declineNeeded = true;
+            stopDhcpTimer(&newAddTimer);
             newAddTimer = startPeriodicTimer(callbackDhcpGetNewAddressTimer, 15, NULL);
         }
     }
@@ -594,12 +623,15 @@ void disableDhcp() {
     setIpDnsAddress(unboundIp);
     setIpTimeServerAddress(unboundIp);
     setIpMqttBrokerAddress(unboundIp);
-    stopTimer(t1HitTimer);
-    stopTimer(t1PeriodicTimer);
-    stopTimer(t2HitTimer);
-    stopTimer(t2PeriodicTimer);
-    stopTimer(leaseEndTimer);
-    stopTimer(leaseTickTimer);
+    stopDhcpTimer(&t1HitTimer);
+    stopDhcpTimer(&t1PeriodicTimer);
+    stopDhcpTimer(&t2HitTimer);
+    stopDhcpTimer(&t2PeriodicTimer);
+    stopDhcpTimer(&leaseEndTimer);
+    stopDhcpTimer(&leaseTickTimer);
+    stopDhcpTimer(&releaseTimer);
+    stopDhcpTimer(&arpTestTimer);
+    stopDhcpTimer(&newAddTimer);
     releaseNeeded = true;
     dhcpEnabled = false;
 }
@@ -609,3 +641,10 @@ bool isDhcpEnabled()
     return dhcpEnabled;
 }
 
+// Returns true while DHCP replies may arrive as broadcasts
+// (the broadcast flag is set in every request, so until bound)
+bool isDhcpBroadcastNeeded(void)
+{
+    return dhcpEnabled && getDhcpState() != DHCP_BOUND;
+}
+
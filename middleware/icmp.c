@@ -16,15 +16,19 @@
 #include "clock.h"
 #include "uart0.h"
 #include "ip.h"
+#include "netif.h"
 #include "arp.h"
 #include "timer.h"
 #include <stdio.h>
+#include <string.h>
+#include <stddef.h>
 
 //=============================================================================
 // DEFINES AND MACROS
 //=============================================================================
 
 #define ICMP_ECHO_TIMEOUT 3
+#define ICMP_ARP_TIMEOUT 3   // extra seconds allowed when the request waits on ARP
 #define ICMP_MAX_ECHO_ATTEMPTS 4
 
 #define ICMP_DEFAULT_ECHO_DATA "abcdefghijklmnopqrstuvwabcdefghi"
@@ -37,7 +41,7 @@
 
 uint32_t pingStart;
 uint8_t pinging;
-uint8_t pingTimeoutTimer;
+uint16_t pingTimeoutTimer;
 uint8_t pingingIp[4];
 
 //=============================================================================
@@ -45,26 +49,63 @@ uint8_t pingingIp[4];
 //=============================================================================
 
 static void pingTimeoutCallback(void* c) {
-    putsUart0("Request timed out.\n");
-    pinging = 0;
+    if (pinging) {
+        putsUart0("Request timed out.\n");
+        pinging = 0;
+    }
 }
 
-static void icmpArpResCallback(arpRespContext resp) {
-    //when we get the MAC address
-    if (resp.success) {
-        //if MAC was retrieved
-        uint8_t buffer[MAX_PACKET_SIZE];
-        etherHeader* ether = (etherHeader*)buffer;
-        copyMacAddress(ether->destAddress, resp.responseMacAddress);
-        sendPingRequest(ether, (uint8_t*)resp.ctxt); //context is the passed IP address
-    }
-    else {
-        //if ARP timed out
+static void icmpArpFailedCallback(arpRespContext resp) {
+    //ARP timed out, request was never sent
+    (void)resp;
+    if (pinging) {
+        stopTimer(pingTimeoutTimer);
         putsUart0("Destination host unreachable.\n");
         pinging = 0;
     }
 }
 
+// Fills in the whole echo request, the ICMP checksum is left for the
+// controller if offload is set. Returns the frame size
+static uint16_t buildPingRequest(etherHeader* ether, uint8_t ipAdd[], bool offload) {
+    ipHeader* ip = getIpHeader(ether);
+    uint32_t sum = 0;
+    getNetifMacAddress(ether->sourceAddress);
+    ether->frameType = htons(TYPE_IP);
+    // IP header
+    ip->rev = 0x4;
+    ip->size = 0x5;
+    ip->typeOfService = 0;
+    ip->id = 0;
+    ip->flagsAndOffset = 0;
+    ip->ttl = 128;
+    ip->protocol = PROTOCOL_ICMP;
+    ip->headerChecksum = 0;
+    getIpAddress(ip->sourceIp);
+    copyIpAddress(ip->destIp, ipAdd);
+    uint8_t ipHeaderLength = ip->size * 4;
+    icmpHeader* icmp = (icmpHeader*)((uint8_t*)ip + ipHeaderLength);
+    icmp->type = 8;
+    icmp->code = 0;
+    icmp->check = 0;
+    icmp->id = htons(0x0001);
+    icmp->seq_no = 1;
+    uint16_t data_size = ICMP_DEFAULT_ECHO_SIZE;
+    uint16_t icmp_size = sizeof(icmpHeader) + data_size;
+    ip->length = htons(ipHeaderLength + icmp_size);
+    //icmp->data = "abcdefghijklmnopqrstuvwxyzabcdef";
+    calcIpChecksum(ip);
+    if (offload) {
+        memcpy(icmp->data, ICMP_DEFAULT_ECHO_DATA, data_size);
+    }
+    else {
+        sumIpWords(icmp, sizeof(icmpHeader), &sum);
+        copyIpWords(icmp->data, ICMP_DEFAULT_ECHO_DATA, data_size, &sum);
+        icmp->check = getIpChecksum(sum);
+    }
+    return sizeof(etherHeader) + ntohs(ip->length);
+}
+
 //=============================================================================
 // PUBLIC FUNCTIONS
 //=============================================================================
@@ -73,9 +114,22 @@ static void icmpArpResCallback(arpRespContext resp) {
 void ping(uint8_t ipAdd[]) {
     if (!pinging) {
         if (isIpValid(ipAdd)) {
+            uint8_t buffer[MAX_PACKET_SIZE];
+            etherHeader* ether = (etherHeader*)buffer;
             pinging = 1;
             copyIpAddress(pingingIp, ipAdd);
-            resolveMacAddress(pingingIp, icmpArpResCallback, pingingIp);
+            if (lookupArpNextHop(pingingIp, ether->destAddress)) {
+                sendPingRequest(ether, pingingIp);
+            }
+            else if (queueArpFrame(pingingIp, ether, buildPingRequest(ether, pingingIp, false), icmpArpFailedCallback, NULL)) {
+                //time from now, the request goes out once ARP resolves
+                pingStart = millis();
+                pingTimeoutTimer = startOneshotTimer(pingTimeoutCallback, ICMP_ECHO_TIMEOUT + ICMP_ARP_TIMEOUT, NULL);
+            }
+            else {
+                putsUart0("Destination host unreachable.\n");
+                pinging = 0;
+            }
         }
         else {
             putsUart0("Invalid IP Address\n");
@@ -115,44 +169,16 @@ uint8_t isPingResponse(etherHeader* ether, icmpEchoResponse* reply) {
 
 void sendPingRequest(etherHeader* ether, uint8_t ipAdd[]) {
     //dest MAC need to be set before this is called
-    ipHeader* ip = getIpHeader(ether);
-    uint32_t sum = 0;
-    getEtherMacAddress(ether->sourceAddress);
-    ether->frameType = htons(TYPE_IP);
-    // IP header
-    ip->rev = 0x4;
-    ip->size = 0x5;
-    ip->typeOfService = 0;
-    ip->id = 0;
-    ip->flagsAndOffset = 0;
-    ip->ttl = 128;
-    ip->protocol = PROTOCOL_ICMP;
-    ip->headerChecksum = 0;
-    getIpAddress(ip->sourceIp);
-    copyIpAddress(ip->destIp, ipAdd);
-    uint8_t ipHeaderLength = ip->size * 4;
-    icmpHeader* icmp = (icmpHeader*)((uint8_t*)ip + ipHeaderLength);
-    icmp->type = 8;
-    icmp->code = 0;
-    icmp->check = 0;
-    icmp->id = htons(0x0001);
-    icmp->seq_no = 1;
-    uint16_t data_size = ICMP_DEFAULT_ECHO_SIZE;
-    uint8_t i;
-    for (i = 0; i < data_size; i++) {
-        icmp->data[i] = (ICMP_DEFAULT_ECHO_DATA)[i];
-    }
-    uint16_t icmp_size = sizeof(icmpHeader) + data_size;
-    ip->length = htons(ipHeaderLength + icmp_size);
-    //icmp->data = "abcdefghijklmnopqrstuvwxyzabcdef";
-    icmp->check = 0;
-    calcIpChecksum(ip);
-    //icmp_size = ntohs(ip->length) - ipHeaderLength;
-    sumIpWords(icmp, icmp_size, &sum);
-    icmp->check = getIpChecksum(sum);
+    bool offload = isNetifChecksumOffload();
+    uint16_t size = buildPingRequest(ether, ipAdd, offload);
+    uint16_t l4Offset = sizeof(etherHeader) + getIpHeader(ether)->size * 4;
     pingStart = millis(); //for timing response
     pingTimeoutTimer = startOneshotTimer(pingTimeoutCallback, ICMP_ECHO_TIMEOUT, ether); //NOT for timing response
-    putEtherPacket(ether, sizeof(etherHeader) + ntohs(ip->length));
+    if (offload) {
+        putNetifPacketWithChecksum(ether, size, l4Offset, l4Offset + offsetof(icmpHeader, check));
+        return;
+    }
+    putNetifPacket(ether, size);
 }
 
 // Sends a ping response given the request data
@@ -178,10 +204,15 @@ void sendPingResponse(etherHeader *ether) {
     icmp->type = 0;
     // calc icmp checksum
     icmp->check = 0;
+    if (isNetifChecksumOffload()) {
+        putNetifPacketWithChecksum(ether, sizeof(etherHeader) + ntohs(ip->length), sizeof(etherHeader) + ipHeaderLength,
+                                   sizeof(etherHeader) + ipHeaderLength + offsetof(icmpHeader, check));
+        return;
+    }
     icmp_size = ntohs(ip->length) - ipHeaderLength;
     sumIpWords(icmp, icmp_size, &sum);
     icmp->check = getIpChecksum(sum);
     // send packet
-    putEtherPacket(ether, sizeof(etherHeader) + ntohs(ip->length));
+    putNetifPacket(ether, sizeof(etherHeader) + ntohs(ip->length));
 }
 
@@ -13,7 +13,9 @@
 //=============================================================================
 
 #include "ip.h"
+#include "netif.h"
 #include <stdio.h>
+#include <string.h>
 
 //=============================================================================
 // DEFINES AND MACROS
@@ -26,12 +28,7 @@
 const uint8_t EMPTY_IP_ADDRESS[IP_ADD_LENGTH] = {0, 0, 0, 0};
 const uint8_t BROADCAST_IP_ADDRESS[IP_ADD_LENGTH] = {255, 255, 255, 255};
 
-uint8_t ipAddress[IP_ADD_LENGTH] = {0,0,0,0};
-uint8_t ipSubnetMask[IP_ADD_LENGTH] = {0,0,0,0};
-uint8_t ipGwAddress[IP_ADD_LENGTH] = {0,0,0,0};
-uint8_t ipDnsAddress[IP_ADD_LENGTH] = {0,0,0,0};
-uint8_t ipTimeServerAddress[IP_ADD_LENGTH] = {0,0,0,0};
-uint8_t ipMqttBrokerAddress[IP_ADD_LENGTH] = {0,0,0,0};
+// Addresses live in the current interface's ipConfig (see netif.h)
 
 //=============================================================================
 // PUBLIC FUNCTIONS
@@ -67,6 +64,7 @@ inline ipHeader* getIpHeader(etherHeader* ether) {
 bool isIpUnicast(etherHeader *ether)
 {
     ipHeader* ip = (ipHeader*)ether->data;
+    uint8_t* ipAddress = getNetifIpConfig()->address;
     uint8_t i = 0;
     bool ok = true;
     while (ok && (i < IP_ADD_LENGTH))
@@ -115,26 +113,160 @@ bool isIpEqual(uint8_t ip1[4], uint8_t ip2[4]) {
     return ok;
 }
 
+// Folds a 64-bit sum of little-endian words into 16 bits (end-around carry)
+static uint32_t foldIpSum(uint64_t acc)
+{
+    uint32_t sum;
+    acc = (acc & 0xFFFFFFFF) + (acc >> 32);
+    acc = (acc & 0xFFFFFFFF) + (acc >> 32);
+    sum = (uint32_t)acc;
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return sum;
+}
+
 // Calculate sum of words
 // Must use getEtherChecksum to complete 1's compliment addition
+// Sums 32 bits at a time into a 64-bit accumulator so carries are only folded
+// once at the end (the M4 does each add as an ADDS/ADC pair, the same work a
+// UADD16 lane sum would need without the lane fix-up). An odd start address is
+// handled by summing the rest one byte out of phase and byte swapping it.
 void sumIpWords(void* data, uint16_t sizeInBytes, uint32_t* sum)
 {
-    uint8_t* pData = (uint8_t*)data;
-    uint16_t i;
-    uint8_t phase = 0;
-    uint16_t data_temp;
-    for (i = 0; i < sizeInBytes; i++)
+    const uint8_t* pData = (const uint8_t*)data;
+    const uint32_t* pWord;
+    uint32_t size = sizeInBytes;
+    uint32_t lead = 0;
+    uint32_t partial;
+    bool swapped = false;
+    uint64_t acc = 0;
+    if (((uintptr_t)pData & 1) && (size > 0))
+    {
+        lead = *pData++;
+        size--;
+        swapped = true;
+    }
+    if (((uintptr_t)pData & 2) && (size >= 2))
+    {
+        acc += *(const uint16_t*)pData;
+        pData += 2;
+        size -= 2;
+    }
+    pWord = (const uint32_t*)pData;
+    while (size >= 16)
     {
-        if (phase)
+        acc += pWord[0];
+        acc += pWord[1];
+        acc += pWord[2];
+        acc += pWord[3];
+        pWord += 4;
+        size -= 16;
+    }
+    while (size >= 4)
+    {
+        acc += *pWord++;
+        size -= 4;
+    }
+    pData = (const uint8_t*)pWord;
+    if (size >= 2)
+    {
+        acc += *(const uint16_t*)pData;
+        pData += 2;
+        size -= 2;
+    }
+    if (size)
+        acc += *pData;
+    partial = foldIpSum(acc);
+    if (swapped)
+        partial = (((partial & 0xFF) << 8) | (partial >> 8)) + lead;
+    *sum += partial;
+}
+
+// Copies sizeInBytes from src to dest and adds the copied words to sum in the
+// same pass, so a payload is only touched once on transmit
+// sum is phased from dest (dest must sit at an even offset in the segment)
+void copyIpWords(void* dest, const void* src, uint16_t sizeInBytes, uint32_t* sum)
+{
+    uint8_t* pDest = (uint8_t*)dest;
+    const uint8_t* pSrc = (const uint8_t*)src;
+    uint32_t size = sizeInBytes;
+    uint32_t lead = 0;
+    uint32_t partial;
+    uint32_t word;
+    bool swapped = false;
+    uint64_t acc = 0;
+    if ((((uintptr_t)pDest ^ (uintptr_t)pSrc) & 1) == 0)
+    {
+        if (((uintptr_t)pSrc & 1) && (size > 0))
+        {
+            lead = *pDest++ = *pSrc++;
+            size--;
+            swapped = true;
+        }
+        if ((((uintptr_t)pDest ^ (uintptr_t)pSrc) & 2) == 0)
+        {
+            if (((uintptr_t)pSrc & 2) && (size >= 2))
+            {
+                word = *(const uint16_t*)pSrc;
+                *(uint16_t*)pDest = word;
+                acc += word;
+                pDest += 2;
+                pSrc += 2;
+                size -= 2;
+            }
+            while (size >= 4)
+            {
+                word = *(const uint32_t*)pSrc;
+                *(uint32_t*)pDest = word;
+                acc += word;
+                pDest += 4;
+                pSrc += 4;
+                size -= 4;
+            }
+        }
+        while (size >= 2)
+        {
+            word = *(const uint16_t*)pSrc;
+            *(uint16_t*)pDest = word;
+            acc += word;
+            pDest += 2;
+            pSrc += 2;
+            size -= 2;
+        }
+    }
+    else
+    {
+        // mismatched alignment, copy bytes but still sum in pairs
+        while (size >= 2)
         {
-            data_temp = *pData;
-            *sum += data_temp << 8;
+            pDest[0] = pSrc[0];
+            pDest[1] = pSrc[1];
+            acc += pSrc[0] | (pSrc[1] << 8);
+            pDest += 2;
+            pSrc += 2;
+            size -= 2;
         }
-        else
-          *sum += *pData;
-        phase = 1 - phase;
-        pData++;
     }
+    if (size)
+    {
+        *pDest = *pSrc;
+        acc += *pSrc;
+    }
+    partial = foldIpSum(acc);
+    if (swapped)
+        partial = (((partial & 0xFF) << 8) | (partial >> 8)) + lead;
+    *sum += partial;
+}
+
+// Adds the TCP/UDP pseudo-header (addresses, protocol, length) to sum
+void sumIpPseudoHeader(ipHeader* ip, uint16_t length, uint32_t* sum)
+{
+    uint16_t tmp16;
+    sumIpWords(ip->sourceIp, 8, sum);
+    tmp16 = ip->protocol;
+    *sum += (tmp16 & 0xff) << 8;
+    tmp16 = htons(length);
+    sumIpWords(&tmp16, 2, sum);
 }
 
 // Completes 1's compliment addition by folding carries back into field
@@ -157,98 +289,86 @@ void calcIpChecksum(ipHeader* ip)
     ip->headerChecksum = getIpChecksum(sum);
 }
 
-// Sets IP address
+// Sets IP address, the generation only moves if the address really changed
+// (a DHCP renewal that keeps the lease sets the same one again)
 void setIpAddress(const uint8_t ip[4])
 {
-    uint8_t i;
-    for (i = 0; i < IP_ADD_LENGTH; i++)
-        ipAddress[i] = ip[i];
+    ipConfig* config = getNetifIpConfig();
+    if (memcmp(config->address, ip, IP_ADD_LENGTH) != 0) {
+        copyIpAddress(config->address, ip);
+        config->generation++;
+    }
 }
 
 // Gets IP address
 void getIpAddress(uint8_t ip[4])
 {
-    uint8_t i;
-    for (i = 0; i < IP_ADD_LENGTH; i++)
-        ip[i] = ipAddress[i];
+    copyIpAddress(ip, getNetifIpConfig()->address);
+}
+
+// Gets a counter that changes every time the IP address changes, so cached
+// headers built with the old address can be detected as stale
+uint16_t getIpAddressGeneration(void)
+{
+    return getNetifIpConfig()->generation;
 }
 
 // Sets IP subnet mask
 void setIpSubnetMask(const uint8_t mask[4])
 {
-    uint8_t i;
-    for (i = 0; i < IP_ADD_LENGTH; i++)
-        ipSubnetMask[i] = mask[i];
+    copyIpAddress(getNetifIpConfig()->subnetMask, mask);
 }
 
 // Gets IP subnet mask
 void getIpSubnetMask(uint8_t mask[4])
 {
-    uint8_t i;
-    for (i = 0; i < IP_ADD_LENGTH; i++)
-        mask[i] = ipSubnetMask[i];
+    copyIpAddress(mask, getNetifIpConfig()->subnetMask);
 }
 
 // Sets IP gateway address
 void setIpGatewayAddress(const uint8_t ip[4])
 {
-    uint8_t i;
-    for (i = 0; i < IP_ADD_LENGTH; i++)
-        ipGwAddress[i] = ip[i];
+    copyIpAddress(getNetifIpConfig()->gateway, ip);
 }
 
 // Gets IP gateway address
 void getIpGatewayAddress(uint8_t ip[4])
 {
-    uint8_t i;
-    for (i = 0; i < IP_ADD_LENGTH; i++)
-        ip[i] = ipGwAddress[i];
+    copyIpAddress(ip, getNetifIpConfig()->gateway);
 }
 
 // Sets IP DNS address
 void setIpDnsAddress(const uint8_t ip[4])
 {
-    uint8_t i;
-    for (i = 0; i < IP_ADD_LENGTH; i++)
-        ipDnsAddress[i] = ip[i];
+    copyIpAddress(getNetifIpConfig()->dns, ip);
 }
 
 // Gets IP gateway address
 void getIpDnsAddress(uint8_t ip[4])
 {
-    uint8_t i;
-    for (i = 0; i < IP_ADD_LENGTH; i++)
-        ip[i] = ipDnsAddress[i];
+    copyIpAddress(ip, getNetifIpConfig()->dns);
 }
 
 // Sets IP time server address
 void setIpTimeServerAddress(const uint8_t ip[4])
 {
-    uint8_t i;
-    for (i = 0; i < IP_ADD_LENGTH; i++)
-        ipTimeServerAddress[i] = ip[i];
+    copyIpAddress(getNetifIpConfig()->timeServer, ip);
 }
 
 // Gets IP time server address
 void getIpTimeServerAddress(uint8_t ip[4])
 {
-    uint8_t i;
-    for (i = 0; i < IP_ADD_LENGTH; i++)
-        ip[i] = ipTimeServerAddress[i];
+    copyIpAddress(ip, getNetifIpConfig()->timeServer);
 }
 
 // Sets IP time server address
 void setIpMqttBrokerAddress(const uint8_t ip[4])
 {
-    uint8_t i;
-    for (i = 0; i < IP_ADD_LENGTH; i++)
-        ipMqttBrokerAddress[i] = ip[i];
+    copyIpAddress(getNetifIpConfig()->mqttBroker, ip);
 }
 
 // Gets IP time server address
 void getIpMqttBrokerAddress(uint8_t ip[4])
 {
-    uint8_t i;
-    for (i = 0; i < IP_ADD_LENGTH; i++)
-        ip[i] = ipMqttBrokerAddress[i];
+    copyIpAddress(ip, getNetifIpConfig()->mqttBroker);
 }
@@ -0,0 +1,301 @@
+/******************************************************************************
+ * File:        netif.c
+ *
+ * Author:      Giancarlo Perez
+ *
+ * Created:     10/17/26
+ *
+ * Description: Network interface layer with loopback and in-memory queue
+ *              backends (the ENC28J60 backend is drivers/netif_ether.c)
+ ******************************************************************************/
+
+//=============================================================================
+// INCLUDES
+//=============================================================================
+
+#include "netif.h"
+#include "ip.h"
+#include "profiler.h"
+#include "trace.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+//=============================================================================
+// STATIC FUNCTIONS
+//=============================================================================
+
+/* Queue backend, frames are copied into the peer's receive ring */
+
+static bool queueIsRxPending(netif* nif) {
+    return nif->rxQueue->count > 0;
+}
+
+static uint8_t queueGetRxCount(netif* nif) {
+    return nif->rxQueue->count;
+}
+
+static uint16_t queuePeek(netif* nif, etherHeader* ether, uint16_t peekSize) {
+    netifQueue* q = nif->rxQueue;
+    netifFrame* f;
+    if (q->count == 0) {
+        return 0;
+    }
+    f = &q->frames[q->head];
+    if (peekSize > f->size) {
+        peekSize = f->size;
+    }
+    memcpy(ether, f->data, peekSize);
+    q->rxRead = peekSize;
+    return f->size;
+}
+
+static void queueDiscard(netif* nif) {
+    netifQueue* q = nif->rxQueue;
+    if (q->count == 0) {
+        return;
+    }
+    q->head = (q->head + 1) & (NETIF_QUEUE_SIZE - 1);
+    q->count--;
+    q->rxRead = 0;
+}
+
+static uint16_t queueFinish(netif* nif, etherHeader* ether, uint16_t maxSize) {
+    netifQueue* q = nif->rxQueue;
+    netifFrame* f;
+    uint16_t size;
+    if (q->count == 0) {
+        return 0;
+    }
+    f = &q->frames[q->head];
+    size = (f->size < maxSize) ? f->size : maxSize;
+    if (size > q->rxRead) {
+        memcpy((uint8_t*)ether + q->rxRead, f->data + q->rxRead, size - q->rxRead);
+    }
+    queueDiscard(nif);
+    return size;
+}
+
+static bool queueTx(netif* nif, etherHeader* ether, uint16_t size) {
+    netifQueue* q;
+    netifFrame* f;
+    if (nif->peer == NULL || size > MAX_PACKET_SIZE) {
+        return false;
+    }
+    q = nif->peer->rxQueue;
+    if (q->count == NETIF_QUEUE_SIZE) {
+        q->drops++;
+        return false;
+    }
+    f = &q->frames[(q->head + q->count) & (NETIF_QUEUE_SIZE - 1)];
+    memcpy(f->data, ether, size);
+    f->size = size;
+    q->count++;
+    return true;
+}
+
+static bool queueIsLinkUp(netif* nif) {
+    return nif->peer != NULL;
+}
+
+static void queueGetMacAddress(netif* nif, uint8_t mac[HW_ADD_LENGTH]) {
+    memcpy(mac, nif->macAddress, HW_ADD_LENGTH);
+}
+
+/* No interface, what the stack talks to until setNetif() is called: nothing
+ * is ever received and every frame sent is dropped */
+
+static bool noneIsRxPending(netif* nif) {
+    (void)nif;
+    return false;
+}
+
+static uint8_t noneGetRxCount(netif* nif) {
+    (void)nif;
+    return 0;
+}
+
+static uint16_t nonePeek(netif* nif, etherHeader* ether, uint16_t peekSize) {
+    (void)nif;
+    (void)ether;
+    (void)peekSize;
+    return 0;
+}
+
+static uint16_t noneFinish(netif* nif, etherHeader* ether, uint16_t maxSize) {
+    (void)nif;
+    (void)ether;
+    (void)maxSize;
+    return 0;
+}
+
+static void noneDiscard(netif* nif) {
+    (void)nif;
+}
+
+static bool noneTx(netif* nif, etherHeader* ether, uint16_t size) {
+    (void)nif;
+    (void)ether;
+    (void)size;
+    return false;
+}
+
+static bool noneIsLinkUp(netif* nif) {
+    (void)nif;
+    return false;
+}
+
+//=============================================================================
+// GLOBALS
+//=============================================================================
+
+static const uint8_t loopbackMac[HW_ADD_LENGTH] = {0, 0, 0, 0, 0, 0};
+
+static const netifOps queueOps = {
+    .isRxPending = queueIsRxPending,
+    .getRxCount = queueGetRxCount,
+    .peek = queuePeek,
+    .finish = queueFinish,
+    .discard = queueDiscard,
+    .tx = queueTx,
+    .isLinkUp = queueIsLinkUp,
+    .getMacAddress = queueGetMacAddress
+};
+
+static const netifOps noneOps = {
+    .isRxPending = noneIsRxPending,
+    .getRxCount = noneGetRxCount,
+    .peek = nonePeek,
+    .finish = noneFinish,
+    .discard = noneDiscard,
+    .tx = noneTx,
+    .isLinkUp = noneIsLinkUp,
+    .getMacAddress = queueGetMacAddress     // all zeros
+};
+
+static netif noNetif = { .name = "none", .ops = &noneOps };
+
+static netif* currentNetif = &noNetif;
+
+//=============================================================================
+// PUBLIC FUNCTIONS
+//=============================================================================
+
+// Sets up an interface whose transmitted frames come straight back
+void initLoopbackNetif(netif* nif, netifQueue* queue) {
+    initQueueNetif(nif, "lo", queue, loopbackMac);
+    nif->peer = nif;
+}
+
+// Sets up an interface that exchanges frames with a peer through memory
+// It has no link until connected with connectQueueNetifs()
+void initQueueNetif(netif* nif, const char* name, netifQueue* queue, const uint8_t mac[HW_ADD_LENGTH]) {
+    memset(nif, 0, sizeof(netif));
+    memset(queue, 0, sizeof(netifQueue));
+    nif->name = name;
+    nif->ops = &queueOps;
+    nif->rxQueue = queue;
+    memcpy(nif->macAddress, mac, HW_ADD_LENGTH);
+}
+
+void connectQueueNetifs(netif* a, netif* b) {
+    a->peer = b;
+    b->peer = a;
+}
+
+// Selects the interface the stack sends and receives on, must be called
+// before anything touches the IP configuration. NULL selects none
+void setNetif(netif* nif) {
+    currentNetif = (nif != NULL) ? nif : &noNetif;
+}
+
+netif* getNetif(void) {
+    return currentNetif;
+}
+
+ipConfig* getNetifIpConfig(void) {
+    return &currentNetif->ip;
+}
+
+bool isNetifRxPending(void) {
+    return currentNetif->ops->isRxPending(currentNetif);
+}
+
+// Cycle count when the interface signaled the frames the last
+// isNetifRxPending() found, false if it cannot tell
+bool getNetifRxEventTime(uint32_t* cycles) {
+    return currentNetif->ops->getRxEventTime && currentNetif->ops->getRxEventTime(currentNetif, cycles);
+}
+
+uint8_t getNetifPacketCount(void) {
+    return currentNetif->ops->getRxCount(currentNetif);
+}
+
+// Copies the first peekSize bytes of the next frame, returns the frame size
+// or 0 if there is none. Must be followed by finish or discard
+uint16_t peekNetifPacket(etherHeader* ether, uint16_t peekSize) {
+    return currentNetif->ops->peek(currentNetif, ether, peekSize);
+}
+
+uint16_t finishNetifPacket(etherHeader* ether, uint16_t maxSize) {
+    return currentNetif->ops->finish(currentNetif, ether, maxSize);
+}
+
+void discardNetifPacket(void) {
+    currentNetif->ops->discard(currentNetif);
+}
+
+bool isNetifRxOverflow(void) {
+    return currentNetif->ops->isRxOverflow && currentNetif->ops->isRxOverflow(currentNetif);
+}
+
+// Checksum of a peeked frame's bytes computed by the interface, if it can
+bool getNetifRxChecksum(uint16_t offset, uint16_t size, uint16_t* csum) {
+    return currentNetif->ops->getRxChecksum && currentNetif->ops->getRxChecksum(currentNetif, offset, size, csum);
+}
+
+// Interfaces without a hardware filter pass everything
+void setNetifReceiveFilter(bool broadcast, const uint8_t groups[][HW_ADD_LENGTH], uint8_t groupCount) {
+    if (currentNetif->ops->setRxFilter) {
+        currentNetif->ops->setRxFilter(currentNetif, broadcast, groups, groupCount);
+    }
+}
+
+bool putNetifPacket(etherHeader* ether, uint16_t size) {
+    bool ok;
+    recordTraceFrame(TRACE_TX_FRAME, ether, size);
+    PROFILE(PROFILE_TX_FRAME, ok = currentNetif->ops->tx(currentNetif, ether, size));
+    return ok;
+}
+
+bool isNetifChecksumOffload(void) {
+    return currentNetif->ops->isChecksumOffload && currentNetif->ops->isChecksumOffload(currentNetif);
+}
+
+// Only valid when isNetifChecksumOffload() is true
+bool putNetifPacketWithChecksum(etherHeader* ether, uint16_t size, uint16_t sumStart, uint16_t sumOffset) {
+    bool ok;
+    recordTraceFrame(TRACE_TX_FRAME, ether, size);
+    PROFILE(PROFILE_TX_FRAME, ok = currentNetif->ops->txWithChecksum(currentNetif, ether, size, sumStart, sumOffset));
+    return ok;
+}
+
+// Background work such as finishing async transmits
+void pollNetif(void) {
+    if (currentNetif->ops->poll) {
+        currentNetif->ops->poll(currentNetif);
+    }
+}
+
+// True while frames are waiting for the interface to finish them (pollNetif)
+bool isNetifTxBusy(void) {
+    return currentNetif->ops->isTxBusy && currentNetif->ops->isTxBusy(currentNetif);
+}
+
+bool isNetifLinkUp(void) {
+    return currentNetif->ops->isLinkUp(currentNetif);
+}
+
+void getNetifMacAddress(uint8_t mac[HW_ADD_LENGTH]) {
+    currentNetif->ops->getMacAddress(currentNetif, mac);
+}
@@ -0,0 +1,264 @@
+/******************************************************************************
+ * File:        packet.c
+ *
+ * Author:      Giancarlo Perez
+ *
+ * Created:     10/17/26
+ *
+ * Description: Single-pass receive classifier
+ ******************************************************************************/
+
+//=============================================================================
+// INCLUDES
+//=============================================================================
+
+#include "packet.h"
+#include "ip.h"
+#include "arp.h"
+#include "icmp.h"
+#include "tcp.h"
+#include "udp.h"
+#include "dhcp.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+//=============================================================================
+// DEFINES AND MACROS
+//=============================================================================
+
+/* ARP Operations */
+#define ARP_OP_REQUEST 1
+#define ARP_OP_RESPONSE 2
+
+//=============================================================================
+// STATIC FUNCTIONS
+//=============================================================================
+
+static uint8_t classifyArp(packetInfo* pkt) {
+    arpPacket* arp = (arpPacket*)pkt->ether->data;
+    uint8_t localIpAddress[IP_ADD_LENGTH];
+    if (pkt->size < sizeof(etherHeader) + sizeof(arpPacket)) {
+        return PACKET_DROP;
+    }
+    if (arp->op == htons(ARP_OP_RESPONSE)) {
+        return PACKET_ARP_RESPONSE;
+    }
+    getIpAddress(localIpAddress);
+    if (arp->op == htons(ARP_OP_REQUEST)) {
+        return isIpEqual(arp->destIp, localIpAddress) ? PACKET_ARP_REQUEST : PACKET_ARP_OTHER;
+    }
+    return PACKET_DROP;
+}
+
+// Adds the L4 bytes to a checksum, using the controller's sum if it has one
+static void sumL4Words(packetInfo* pkt, uint8_t* l4, uint16_t l4Length, uint32_t* sum) {
+    if (pkt->hwChecksumValid) {
+        *sum += (uint16_t)~pkt->hwChecksum;
+    }
+    else {
+        sumIpWords(l4, l4Length, sum);
+    }
+}
+
+// Validates the L4 header and checksum, fills in ports and payload
+static uint8_t classifyIpPayload(packetInfo* pkt, ipHeader* ip, uint16_t l4Length) {
+    uint8_t* l4 = (uint8_t*)ip + ip->size * 4;
+    uint16_t headerLength;
+    uint32_t sum = 0;
+    switch (pkt->protocol) {
+    case PROTOCOL_ICMP:
+        if (!pkt->unicast || l4Length < sizeof(icmpHeader)) {
+            return PACKET_DROP;
+        }
+        sumL4Words(pkt, l4, l4Length, &sum);
+        headerLength = sizeof(icmpHeader);
+        pkt->l4ChecksumOk = (getIpChecksum(sum) == 0);
+        break;
+    case PROTOCOL_TCP:
+        if (!pkt->unicast || l4Length < sizeof(tcpHeader)) {
+            return PACKET_DROP;
+        }
+        headerLength = (ntohs(((tcpHeader*)l4)->offsetFields) >> OFS_SHIFT) * 4;
+        if (headerLength < sizeof(tcpHeader) || headerLength > l4Length) {
+            return PACKET_DROP;
+        }
+        sumIpPseudoHeader(ip, l4Length, &sum);
+        sumL4Words(pkt, l4, l4Length, &sum);
+        pkt->l4ChecksumOk = (getIpChecksum(sum) == 0);
+        pkt->sourcePort = ntohs(((tcpHeader*)l4)->sourcePort);
+        pkt->destPort = ntohs(((tcpHeader*)l4)->destPort);
+        break;
+    case PROTOCOL_UDP:
+        if (l4Length < sizeof(udpHeader) || ntohs(((udpHeader*)l4)->length) > l4Length
+                || ntohs(((udpHeader*)l4)->length) < sizeof(udpHeader)) {
+            return PACKET_DROP;
+        }
+        if (ntohs(((udpHeader*)l4)->length) != l4Length) {
+            pkt->hwChecksumValid = false; // controller summed the whole ip payload
+        }
+        l4Length = ntohs(((udpHeader*)l4)->length);
+        headerLength = sizeof(udpHeader);
+        if (((udpHeader*)l4)->check != 0) {
+            sumIpPseudoHeader(ip, l4Length, &sum);
+            sumL4Words(pkt, l4, l4Length, &sum);
+            pkt->l4ChecksumOk = (getIpChecksum(sum) == 0);
+        }
+        else {
+            pkt->l4ChecksumOk = true; // sender did not compute a checksum
+        }
+        pkt->sourcePort = ntohs(((udpHeader*)l4)->sourcePort);
+        pkt->destPort = ntohs(((udpHeader*)l4)->destPort);
+        break;
+    default:
+        return PACKET_DROP;
+    }
+    pkt->l4Offset = pkt->ipOffset + ip->size * 4;
+    pkt->payloadOffset = pkt->l4Offset + headerLength;
+    pkt->payload = (uint8_t*)pkt->ether + pkt->payloadOffset;
+    pkt->payloadLength = l4Length - headerLength;
+    if (!pkt->l4ChecksumOk) {
+        return PACKET_DROP;
+    }
+    switch (pkt->protocol) {
+    case PROTOCOL_ICMP:
+        return PACKET_ICMP;
+    case PROTOCOL_TCP:
+        return PACKET_TCP;
+    default:
+        if (pkt->unicast) {
+            return PACKET_UDP;
+        }
+        return (pkt->destPort == DHCP_DEST_PORT_S) ? PACKET_DHCP : PACKET_DROP;
+    }
+}
+
+static uint8_t classifyIp(packetInfo* pkt) {
+    ipHeader* ip = (ipHeader*)pkt->ether->data;
+    uint16_t ipHeaderLength;
+    uint16_t ipLength;
+    uint32_t sum = 0;
+    uint8_t localIpAddress[IP_ADD_LENGTH];
+    if (pkt->size < sizeof(etherHeader) + sizeof(ipHeader)) {
+        return PACKET_DROP;
+    }
+    ipHeaderLength = ip->size * 4;
+    ipLength = ntohs(ip->length);
+    if (ip->rev != 4 || ipHeaderLength < sizeof(ipHeader) || ipLength < ipHeaderLength
+            || ipLength > pkt->size - sizeof(etherHeader)) {
+        return PACKET_DROP;
+    }
+    sumIpWords(ip, ipHeaderLength, &sum);
+    pkt->ipChecksumOk = (getIpChecksum(sum) == 0);
+    if (!pkt->ipChecksumOk) {
+        return PACKET_DROP;
+    }
+    getIpAddress(localIpAddress);
+    pkt->unicast = isIpEqual(ip->destIp, localIpAddress);
+    pkt->protocol = ip->protocol;
+    return classifyIpPayload(pkt, ip, ipLength - ipHeaderLength);
+}
+
+//=============================================================================
+// PUBLIC FUNCTIONS
+//=============================================================================
+
+// Finds the L4 header and length of an IPv4 frame from its first bytes
+// Returns false if the frame is not IPv4 or the header is not all there
+bool getPacketL4Range(etherHeader* ether, uint16_t size, uint16_t* offset, uint16_t* length) {
+    ipHeader* ip = (ipHeader*)ether->data;
+    uint16_t ipHeaderLength;
+    uint16_t ipLength;
+    if (size < sizeof(etherHeader) + sizeof(ipHeader) || ntohs(ether->frameType) != TYPE_IP) {
+        return false;
+    }
+    ipHeaderLength = ip->size * 4;
+    ipLength = ntohs(ip->length);
+    if (ipHeaderLength < sizeof(ipHeader) || ipLength <= ipHeaderLength) {
+        return false;
+    }
+    *offset = sizeof(etherHeader) + ipHeaderLength;
+    *length = ipLength - ipHeaderLength;
+    return true;
+}
+
+// Decides from the first bytes of a frame whether it is worth copying the
+// rest of it, nothing is validated here so parsePacket() still has to run
+// Frames too short to tell are kept
+bool isPacketWanted(etherHeader* ether, uint16_t size) {
+    ipHeader* ip = (ipHeader*)ether->data;
+    udpHeader* udp;
+    packetInfo pkt;
+    uint16_t ipHeaderLength;
+    uint8_t localIpAddress[IP_ADD_LENGTH];
+    if (size < sizeof(etherHeader)) {
+        return true;
+    }
+    switch (ntohs(ether->frameType)) {
+    case TYPE_ARP:
+        if (size < sizeof(etherHeader) + sizeof(arpPacket)) {
+            return true;
+        }
+        pkt.ether = ether;
+        pkt.size = size;
+        return classifyArp(&pkt) != PACKET_DROP;
+    case TYPE_IP:
+        if (size < sizeof(etherHeader) + sizeof(ipHeader)) {
+            return true;
+        }
+        if (ip->rev != 4) {
+            return false;
+        }
+        getIpAddress(localIpAddress);
+        if (isIpEqual(ip->destIp, localIpAddress)) {
+            // unicast icmp/tcp/udp all have handlers (closed tcp ports get a reset)
+            return ip->protocol == PROTOCOL_ICMP || ip->protocol == PROTOCOL_TCP
+                    || ip->protocol == PROTOCOL_UDP;
+        }
+        // only broadcasts for the dhcp client are of interest
+        if (ip->protocol != PROTOCOL_UDP) {
+            return false;
+        }
+        ipHeaderLength = ip->size * 4;
+        if (size < sizeof(etherHeader) + ipHeaderLength + sizeof(udpHeader)) {
+            return true;
+        }
+        udp = (udpHeader*)((uint8_t*)ip + ipHeaderLength);
+        return ntohs(udp->destPort) == DHCP_DEST_PORT_S;
+    default:
+        return false;
+    }
+}
+
+// Validates and parses a received frame exactly once
+// Returns the handler the frame should be dispatched to (also stored in pkt->type)
+uint8_t parsePacket(etherHeader* ether, uint16_t size, packetInfo* pkt) {
+    pkt->ether = ether;
+    pkt->size = size;
+    pkt->etherType = 0;
+    pkt->protocol = 0;
+    pkt->ipOffset = sizeof(etherHeader);
+    pkt->l4Offset = 0;
+    pkt->payloadOffset = 0;
+    pkt->sourcePort = 0;
+    pkt->destPort = 0;
+    pkt->payload = NULL;
+    pkt->payloadLength = 0;
+    pkt->ipChecksumOk = false;
+    pkt->l4ChecksumOk = false;
+    pkt->unicast = false;
+    pkt->type = PACKET_DROP;
+    if (size < sizeof(etherHeader)) {
+        return pkt->type;
+    }
+    pkt->etherType = ntohs(ether->frameType);
+    switch (pkt->etherType) {
+    case TYPE_ARP:
+        pkt->type = classifyArp(pkt);
+        break;
+    case TYPE_IP:
+        pkt->type = classifyIp(pkt);
+        break;
+    }
+    return pkt->type;
+}
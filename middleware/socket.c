@@ -14,11 +14,14 @@
 
 #include "socket.h"
 #include "ip.h"
+#include "netif.h"
 #include "arp.h"
 #include "udp.h"
 #include "tcp.h"
 #include "timer.h"
+#include "trace.h"
 #include <stdio.h>
+#include <string.h>
 
 //=============================================================================
 // DEFINES AND MACROS
@@ -31,6 +34,59 @@
 uint8_t socketCount = 0;
 socket sockets[MAX_SOCKETS];
 
+//=============================================================================
+// STATIC FUNCTIONS
+//=============================================================================
+
+// Builds the ether/ip/l4 header template for a socket along with the partial
+// checksums of everything in it that stays constant for the connection
+static void buildSocketTxHeader(socket* s, uint8_t protocol) {
+    etherHeader* ether = (etherHeader*)s->txHeader;
+    ipHeader* ip = (ipHeader*)ether->data;
+    uint8_t localHwAddress[HW_ADD_LENGTH];
+    uint8_t localIpAddress[IP_ADD_LENGTH];
+    uint32_t sum;
+    memset(s->txHeader, 0, SOCKET_TX_HEADER_SIZE);
+    getNetifMacAddress(localHwAddress);
+    getIpAddress(localIpAddress);
+    // Ether frame
+    copyMacAddress(ether->destAddress, s->remoteHwAddress);
+    copyMacAddress(ether->sourceAddress, localHwAddress);
+    ether->frameType = htons(TYPE_IP);
+    // IP header, length and checksum are filled in per segment
+    ip->rev = 0x4;
+    ip->size = 0x5;
+    ip->ttl = 128;
+    ip->protocol = protocol;
+    copyIpAddress(ip->destIp, s->remoteIpAddress);
+    copyIpAddress(ip->sourceIp, localIpAddress);
+    sum = 0;
+    sumIpWords(ip, sizeof(ipHeader), &sum);
+    s->txIpSum = sum;
+    // Pseudo-header without the length
+    sum = 0;
+    sumIpWords(ip->sourceIp, 8, &sum);
+    sum += ((uint32_t)protocol & 0xff) << 8;
+    s->txPseudoSum = sum;
+    // L4 header, seq/ack/flags (tcp) or length (udp) are filled in per segment
+    if (protocol == PROTOCOL_TCP) {
+        tcpHeader* tcp = (tcpHeader*)ip->data;
+        tcp->sourcePort = htons(s->localPort);
+        tcp->destPort = htons(s->remotePort);
+        tcp->windowSize = htons(WINDOW_SIZE);
+        sumIpWords(tcp, sizeof(tcpHeader), &sum);
+    }
+    else {
+        udpHeader* udp = (udpHeader*)ip->data;
+        udp->sourcePort = htons(s->localPort);
+        udp->destPort = htons(s->remotePort);
+        sumIpWords(udp, sizeof(udpHeader), &sum);
+    }
+    s->txL4Sum = sum;
+    s->txHeaderGeneration = getIpAddressGeneration();
+    s->txHeaderValid = true;
+}
+
 //=============================================================================
 // PUBLIC FUNCTIONS
 //=============================================================================
@@ -41,6 +97,7 @@ void initSockets(void) {
         sockets[i].state = TCP_CLOSED;
         sockets[i].assocTimer = INVALID_TIMER;
         sockets[i].connectAttempts = 0;
+        sockets[i].txHeaderValid = false;
     }
 }
 
@@ -55,6 +112,7 @@ socket* newSocket(uint8_t type) {
             s = &sockets[i];
             s->type = type;
             s->localPort = (random32() & 0x3FFF) + 49152;
+            s->txHeaderValid = false;
             socketCount++;
         }
         i++;
@@ -89,35 +147,34 @@ socket* getSockets() {
     return sockets;
 }
 
-static void socketSendToCallback(arpRespContext resp) {
-    socket* s = (socket*)resp.ctxt;
-    if (resp.success) {
-        //if MAC was retrieved
-        //finish fnNeedsMAC function
-        uint8_t buffer[MAX_PACKET_SIZE];
-        copyMacAddress(s->remoteHwAddress, resp.responseMacAddress);
-        sendUdpMessage((etherHeader*)buffer, s, s->tx_buffer, s->tx_size);
-        //deleteSocket(s);
-    }
-    else {
-        //could not resolve mac (No arp)
-        //error
-    }
+static void socketSendToFailed(arpRespContext resp) {
+    throwSocketError((socket*)resp.ctxt, SOCKET_ERROR_ARP_TIMEOUT);
 }
 
+// Sends the datagram now if the next hop is known, otherwise ARP holds on to
+// it until it is
 void socketSendTo(socket* s, uint8_t serverIp[4], uint16_t port, uint8_t data[], uint16_t length) {
+    uint8_t buffer[MAX_PACKET_SIZE];
+    uint8_t mac[HW_ADD_LENGTH];
     if (s->type == SOCKET_DGRAM) {
         getIpAddress(s->localIpAddress);
         //s->localPort = (random32() & 0x3FFF) + 49152;
-        copyIpAddress(s->remoteIpAddress, serverIp);
-        s->remotePort = port;
-        uint8_t i;
-        for (i = 0; i < length; i++) {
-            s->tx_buffer[i] = data[i]; //copy data into tx buffer //memcpy(s->tx_buffer, data, length);
+        //the template only needs rebuilding when the destination moves
+        if (!isIpEqual(s->remoteIpAddress, serverIp) || s->remotePort != port) {
+            copyIpAddress(s->remoteIpAddress, serverIp);
+            s->remotePort = port;
+            invalidateSocketTxHeader(s);
+        }
+        if (lookupArpNextHop(serverIp, mac)) {
+            if (memcmp(mac, s->remoteHwAddress, HW_ADD_LENGTH) != 0) {
+                copyMacAddress(s->remoteHwAddress, mac);
+                invalidateSocketTxHeader(s);
+            }
+            sendUdpMessage((etherHeader*)buffer, s, data, length);
+        }
+        else if (!queueArpFrame(serverIp, (etherHeader*)buffer, buildUdpMessage((etherHeader*)buffer, s, data, length), socketSendToFailed, s)) {
+            throwSocketError(s, SOCKET_ERROR_ARP_QUEUE_FULL);
         }
-        //s->tx_buffer = data;
-        s->tx_size = length;
-        resolveMacAddress(serverIp, socketSendToCallback, s);
     }
     else {
         //not a UDP socket
@@ -143,6 +200,7 @@ void socketConnectTcp(socket* s, uint8_t serverIp[4], uint16_t port) {
         //s->localPort = (random32() & 0x3FFF) + 49152;
         copyIpAddress(s->remoteIpAddress, serverIp);
         s->remotePort = port;
+        invalidateSocketTxHeader(s);
         openTcpConnection((etherHeader*)buffer, s);
     }
     else {
@@ -152,15 +210,12 @@ void socketConnectTcp(socket* s, uint8_t serverIp[4], uint16_t port) {
 
 void socketSendTcp(socket* s, uint8_t* data, uint16_t length) {
     if (s->type == SOCKET_STREAM) {
-        if (s->state != TCP_ESTABLISHED) {
+        if (s->state == TCP_ESTABLISHED) {
             uint8_t buffer[MAX_PACKET_SIZE];
             //updateSeqNum(s, ether)
-            uint8_t i;
-            for (i = 0; i < length; i++) {
-                s->tx_buffer[i] = data[i]; //copy data into tx buffer //memcpy(s->tx_buffer, data, length);
-            }
+            //payload is copied straight into the frame by sendTcpMessage
             s->tx_size = length;
-            sendTcpMessage((etherHeader*)buffer, s, PSH | ACK, s->tx_buffer, s->tx_size);
+            sendTcpMessage((etherHeader*)buffer, s, PSH | ACK, data, length);
             s->sequenceNumber += length;
         }
         else {
@@ -212,6 +267,7 @@ void getSocketInfoFromArpResponse(etherHeader* ether, socket* s) {
         s->remoteHwAddress[i] = arp->sourceAddress[i];
     for (i = 0; i < IP_ADD_LENGTH; i++)
         s->remoteIpAddress[i] = arp->sourceIp[i];
+    invalidateSocketTxHeader(s);
 }
 
 // Get socket information from a received UDP packet
@@ -226,6 +282,7 @@ void getSocketInfoFromUdpPacket(etherHeader* ether, socket* s) {
         s->remoteIpAddress[i] = ip->sourceIp[i];
     s->remotePort = ntohs(udp->sourcePort);
     s->localPort = ntohs(udp->destPort);
+    invalidateSocketTxHeader(s);
 }
 
 // Get socket information from a received TCP packet
@@ -240,11 +297,13 @@ void getSocketInfoFromTcpPacket(etherHeader* ether, socket* s) {
         s->remoteIpAddress[i] = ip->sourceIp[i];
     s->remotePort = ntohs(tcp->sourcePort);
     s->localPort = ntohs(tcp->destPort);
+    invalidateSocketTxHeader(s);
 }
 
 //this function shall be called anytime an error occurs and the application needs to be aware of it
 void throwSocketError(socket* s, uint8_t errorCode) {
     socketError err;
+    recordTrace(TRACE_SOCKET_ERROR, errorCode, s->localPort, 0, s->remotePort, convertIpAddressToU32(s->remoteIpAddress));
     err.errorCode = errorCode;
     switch (errorCode) {
     case SOCKET_ERROR_ARP_TIMEOUT:
@@ -256,9 +315,29 @@ void throwSocketError(socket* s, uint8_t errorCode) {
     case SOCKET_ERROR_CONNECTION_RESET:
         snprintf(err.errorMsg, SOCKET_ERROR_MAX_MSG_LEN, "Connection was reset by remote host (%d.%d.%d.%d:%d)", s->remoteIpAddress[0], s->remoteIpAddress[1], s->remoteIpAddress[2], s->remoteIpAddress[3], s->remotePort);
         break;
+    case SOCKET_ERROR_ARP_QUEUE_FULL:
+        snprintf(err.errorMsg, SOCKET_ERROR_MAX_MSG_LEN, "Could not reach %d.%d.%d.%d (no room to hold frame)", s->remoteIpAddress[0], s->remoteIpAddress[1], s->remoteIpAddress[2], s->remoteIpAddress[3]);
+        break;
     }
     err.sk = s;
     if (s->errorCallback) {
         s->errorCallback(&err); // application responsible for deleting socket in the case of an error
     }
 }
+
+// Must be called whenever a socket's addresses or ports change
+void invalidateSocketTxHeader(socket* s) {
+    s->txHeaderValid = false;
+}
+
+// Copies the socket's prebuilt headers to the start of a frame, rebuilding the
+// template first if the socket or the local IP address changed since the last send
+void copySocketTxHeader(socket* s, uint8_t protocol, etherHeader* ether) {
+    ipHeader* ip = (ipHeader*)((etherHeader*)s->txHeader)->data;
+    if (!s->txHeaderValid || s->txHeaderGeneration != getIpAddressGeneration()
+            || ip->protocol != protocol) {
+        buildSocketTxHeader(s, protocol);
+    }
+    memcpy(ether, s->txHeader, (protocol == PROTOCOL_TCP) ? SOCKET_TX_HEADER_SIZE
+            : sizeof(etherHeader) + sizeof(ipHeader) + sizeof(udpHeader));
+}
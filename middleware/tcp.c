@@ -16,10 +16,13 @@
 #include "timer.h"
 #include "arp.h"
 #include "ip.h"
+#include "netif.h"
 #include "tcp.h"
+#include "trace.h"
 #include "socket.h"
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
 
 //=============================================================================
 // DEFINES AND MACROS
@@ -33,48 +36,67 @@
 // STATIC FUNCTIONS
 //=============================================================================
 
+// Flag tests below must only be given TCP packets (validated by parsePacket
+// on receive, or built by this module on send)
+
 static bool isTcpSyn(etherHeader* ether) {
     ipHeader* ip = (ipHeader*)ether->data;
     tcpHeader* tcp = (tcpHeader*)((uint8_t*)ip + ip->size * 4);
-    if (!isTcp(ether)) {
-        return false;
-    }
     return htons(tcp->offsetFields) & SYN;
 }
 
 static bool isTcpAck(etherHeader* ether) {
     ipHeader* ip = (ipHeader*)ether->data;
     tcpHeader* tcp = (tcpHeader*)((uint8_t*)ip + ip->size * 4);
-    if (!isTcp(ether)) {
-        return false;
-    }
     return htons(tcp->offsetFields) & ACK;
 }
 
 static bool isTcpFin(etherHeader* ether) {
     ipHeader* ip = (ipHeader*)ether->data;
     tcpHeader* tcp = (tcpHeader*)((uint8_t*)ip + ip->size * 4);
-    return isTcp(ether) && (htons(tcp->offsetFields) & FIN);
+    return htons(tcp->offsetFields) & FIN;
 }
 
 static bool isTcpPsh(etherHeader* ether) {
     ipHeader* ip = (ipHeader*)ether->data;
     tcpHeader* tcp = (tcpHeader*)((uint8_t*)ip + ip->size * 4);
-    if (!isTcp(ether)) {
-        return false;
-    }
     return htons(tcp->offsetFields) & PSH;
 }
 
 static bool isTcpRst(etherHeader* ether) {
     ipHeader* ip = (ipHeader*)ether->data;
     tcpHeader* tcp = (tcpHeader*)((uint8_t*)ip + ip->size * 4);
-    if (!isTcp(ether)) {
-        return false;
-    }
     return htons(tcp->offsetFields) & RST;
 }
 
+// Takes the peer's MAC once a dropped next hop has been resolved again
+static void tcpNextHopCallback(arpRespContext resp) {
+    socket* s = (socket*)resp.ctxt;
+    if (resp.success && s->state == TCP_ESTABLISHED
+            && memcmp(resp.responseMacAddress, s->remoteHwAddress, HW_ADD_LENGTH) != 0) {
+        copyMacAddress(s->remoteHwAddress, resp.responseMacAddress);
+        invalidateSocketTxHeader(s);
+    }
+}
+
+// Marks an established peer's next hop as in use so ARP keeps it refreshed,
+// and picks up its MAC if a refresh found that it changed. If ARP dropped the
+// entry (the peer stopped answering refreshes) it is resolved again by
+// broadcast, segments keep the old MAC until the reply comes in
+static void updateTcpNextHop(socket* s) {
+    uint8_t mac[HW_ADD_LENGTH];
+    if (s->state != TCP_ESTABLISHED) {
+        return;
+    }
+    if (!lookupArpNextHop(s->remoteIpAddress, mac)) {
+        resolveMacAddress(s->remoteIpAddress, tcpNextHopCallback, s);
+    }
+    else if (memcmp(mac, s->remoteHwAddress, HW_ADD_LENGTH) != 0) {
+        copyMacAddress(s->remoteHwAddress, mac);
+        invalidateSocketTxHeader(s);
+    }
+}
+
 static inline void pendTcpResponse(socket* s, uint8_t flags) {
     s->flags = flags;
 }
@@ -209,6 +231,7 @@ static void tcpArpResCallback(arpRespContext resp) {
     //when we get the MAC address
     socket* s = (socket*)resp.ctxt;
     copyMacAddress(s->remoteHwAddress, resp.responseMacAddress);
+    invalidateSocketTxHeader(s);
     if (resp.success) {
         completeTcpConCallback(s);
     }
@@ -226,6 +249,7 @@ static void tcpArpResCallback(arpRespContext resp) {
 // Set TCP state
 void setTcpState(socket* s, uint8_t state) {
     if (s) {
+        recordTrace(TRACE_TCP_STATE, state, s->localPort, s->state, s->remotePort, convertIpAddressToU32(s->remoteIpAddress));
         s->state = state;
     }
 }
@@ -264,20 +288,13 @@ bool isTcp(etherHeader* ether) {
     ipHeader* ip = (ipHeader*)ether->data;
     tcpHeader* tcp = (tcpHeader*)((uint8_t*)ip + ip->size * 4);
     bool ok;
-    uint16_t tmp16;
-    uint16_t tcpLength = ip->length - ip->size*4;
+    uint16_t tcpLength = ntohs(ip->length) - ip->size*4;
     uint32_t sum = 0;
     ok = (ip->protocol == PROTOCOL_TCP);
     if (ok) {
-        uint16_t tcpLengthHton = htons(tcpLength);
-        sum = 0;
-        sumIpWords(ip->sourceIp, 8, &sum);
-        tmp16 = ip->protocol;
-        sum += (tmp16 & 0xff) << 8;
-        sumIpWords(&tcpLengthHton, 2, &sum);
-        tcp->checksum = 0;
+        sumIpPseudoHeader(ip, tcpLength, &sum);
         sumIpWords(tcp, tcpLength, &sum);
-        tcp->checksum = getIpChecksum(sum);
+        ok = (getIpChecksum(sum) == 0);
     }
     return ok;
 }
@@ -482,39 +499,18 @@ void processTcpResponse(etherHeader* ether) {
 
 void sendTcpResponse(etherHeader* ether, socket* s, uint16_t flags){
     uint32_t sum;
-    uint16_t tmp16;
     uint16_t tcpLength;
+    uint16_t l4Offset;
     uint8_t i;
     uint8_t options_length = 0;
-    uint8_t localHwAddress[6];
-    uint8_t localIpAddress[4];
-    getEtherMacAddress(localHwAddress);
-    getIpAddress(localIpAddress);
-    // Ether frame
-    copyMacAddress(ether->destAddress, s->remoteHwAddress);
-    copyMacAddress(ether->sourceAddress, localHwAddress);
-    ether->frameType = htons(TYPE_IP);
-    // IP header
+    // Ether, IP and TCP headers from the socket's template
+    updateTcpNextHop(s);
+    copySocketTxHeader(s, PROTOCOL_TCP, ether);
     ipHeader* ip = (ipHeader*)ether->data;
-    ip->rev = 0x4;
-    ip->size = 0x5;
-    ip->typeOfService = 0;
-    ip->id = 0x5555;
-    ip->flagsAndOffset = 0;
-    ip->ttl = 128;
-    ip->protocol = PROTOCOL_TCP;
-    ip->headerChecksum = 0;
-    copyIpAddress(ip->destIp, s->remoteIpAddress);
-    copyIpAddress(ip->sourceIp, localIpAddress);
     uint8_t ipHeaderLength = ip->size * 4;
-    // TCP header
-    tcpHeader* tcp = (tcpHeader*)((uint8_t*)ip + (ip->size * 4));
-    tcp->sourcePort = htons(s->localPort);
-    tcp->destPort = htons(s->remotePort);
+    tcpHeader* tcp = (tcpHeader*)((uint8_t*)ip + ipHeaderLength);
     tcp->sequenceNumber = htonl(s->sequenceNumber);
     tcp->acknowledgementNumber = htonl(s->acknowledgementNumber);
-    tcp->windowSize = htons(WINDOW_SIZE);
-    tcp->urgentPointer = 0;
     // TCP Options
     if (flags & SYN) {
         uint8_t optionData[TCP_MAX_OPTION_LENGTH];
@@ -534,72 +530,53 @@ void sendTcpResponse(etherHeader* ether, socket* s, uint16_t flags){
     tcpLength = sizeof(tcpHeader) + options_length;
     tcp->offsetFields = htons(((((uint16_t)(tcpLength/4)) & 0xF) << 12) | flags);
     ip->length = htons(ipHeaderLength + tcpLength);
-
-    calcIpChecksum(ip);
-    uint16_t tcpLengthHton = htons(tcpLength);
-    sum = 0;
-    sumIpWords(ip->sourceIp, 8, &sum);
-    tmp16 = ip->protocol;
-    sum += (tmp16 & 0xff) << 8;
-    sumIpWords(&tcpLengthHton, 2, &sum);
-    tcp->checksum = 0;
-    sumIpWords(tcp, tcpLength, &sum);
+    // only the fields that differ from the template need to be summed
+    sum = s->txIpSum + ip->length;
+    ip->headerChecksum = getIpChecksum(sum);
+    l4Offset = sizeof(etherHeader) + ipHeaderLength;
+    if (isNetifChecksumOffload()) {
+        // controller sums the segment once staged, seed it with the pseudo-header
+        tcp->checksum = ~getIpChecksum(s->txPseudoSum + htons(tcpLength));
+        putNetifPacketWithChecksum(ether, l4Offset + tcpLength, l4Offset, l4Offset + offsetof(tcpHeader, checksum));
+        return;
+    }
+    sum = s->txL4Sum + htons(tcpLength);
+    sumIpWords(&tcp->sequenceNumber, 10, &sum); // seq, ack and offset/flags
+    sumIpWords(tcp->data, options_length, &sum);
     tcp->checksum = getIpChecksum(sum);
-    putEtherPacket(ether, sizeof(etherHeader) + ipHeaderLength + tcpLength);
+    putNetifPacket(ether, l4Offset + tcpLength);
 }
 
 void sendTcpMessage(etherHeader* ether, socket* s, uint16_t flags, uint8_t data[], uint16_t dataSize) {
-    uint8_t i;
     uint32_t sum;
-    uint16_t tmp16;
     uint16_t tcpLength;
-    uint8_t* copyData;
-    uint8_t localHwAddress[6];
-    uint8_t localIpAddress[4];
-    // Ether
-    getEtherMacAddress(localHwAddress);
-    getIpAddress(localIpAddress);
-    copyMacAddress(ether->destAddress, s->remoteHwAddress);
-    copyMacAddress(ether->sourceAddress, localHwAddress);
-    ether->frameType = htons(TYPE_IP);
-    // IP header
+    uint16_t l4Offset;
+    // Ether, IP and TCP headers from the socket's template
+    updateTcpNextHop(s);
+    copySocketTxHeader(s, PROTOCOL_TCP, ether);
     ipHeader* ip = (ipHeader*)ether->data;
-    ip->rev = 0x4;
-    ip->size = 0x5;
-    ip->typeOfService = 0;
-    ip->id = 0;
-    ip->flagsAndOffset = 0;
-    ip->ttl = 128;
-    ip->protocol = PROTOCOL_TCP;
-    ip->headerChecksum = 0;
-    copyIpAddress(ip->destIp, s->remoteIpAddress);
-    copyIpAddress(ip->sourceIp, localIpAddress);
     uint8_t ipHeaderLength = ip->size * 4;
-    // TCP header
-    tcpHeader* tcp = (tcpHeader*)((uint8_t*)ip + (ip->size * 4));
-    tcp->sourcePort = htons(s->localPort);
-    tcp->destPort = htons(s->remotePort);
+    tcpHeader* tcp = (tcpHeader*)((uint8_t*)ip + ipHeaderLength);
     tcp->sequenceNumber = htonl(s->sequenceNumber);
     tcp->acknowledgementNumber = htonl(s->acknowledgementNumber);
-    tcp->windowSize = htons(WINDOW_SIZE);
-    tcp->urgentPointer = 0;
     tcpLength = sizeof(tcpHeader) + dataSize;
     tcp->offsetFields = htons(((((uint16_t)(sizeof(tcpHeader)/4)) & 0xF) << 12) | flags);
     ip->length = htons(ipHeaderLength + tcpLength);
-
-    calcIpChecksum(ip);
-    copyData = tcp->data;
-    for (i = 0; i < dataSize; i++) {
-        copyData[i] = data[i];
+    // only the fields that differ from the template need to be summed
+    sum = s->txIpSum + ip->length;
+    ip->headerChecksum = getIpChecksum(sum);
+    l4Offset = sizeof(etherHeader) + ipHeaderLength;
+    if (isNetifChecksumOffload()) {
+        // controller sums the segment once staged, seed it with the pseudo-header
+        memcpy(tcp->data, data, dataSize);
+        tcp->checksum = ~getIpChecksum(s->txPseudoSum + htons(tcpLength));
+        putNetifPacketWithChecksum(ether, l4Offset + tcpLength, l4Offset, l4Offset + offsetof(tcpHeader, checksum));
+        return;
     }
-    uint16_t tcpLengthHton = htons(tcpLength);
-    sum = 0;
-    sumIpWords(ip->sourceIp, 8, &sum);
-    tmp16 = ip->protocol;
-    sum += (tmp16 & 0xff) << 8;
-    sumIpWords(&tcpLengthHton, 2, &sum);
-    tcp->checksum = 0;
-    sumIpWords(tcp, tcpLength, &sum);
+    sum = s->txL4Sum + htons(tcpLength);
+    sumIpWords(&tcp->sequenceNumber, 10, &sum); // seq, ack and offset/flags
+    // copy payload and sum it in one pass
+    copyIpWords(tcp->data, data, dataSize, &sum);
     tcp->checksum = getIpChecksum(sum);
-    putEtherPacket(ether, sizeof(etherHeader) + ipHeaderLength + tcpLength);
+    putNetifPacket(ether, l4Offset + tcpLength);
 }
@@ -14,8 +14,11 @@
 //=============================================================================
 
 #include "ip.h"
+#include "netif.h"
 #include "udp.h"
 #include <stdio.h>
+#include <string.h>
+#include <stddef.h>
 
 //=============================================================================
 // DEFINES AND MACROS
@@ -25,6 +28,24 @@
 // GLOBALS
 //=============================================================================
 
+//=============================================================================
+// STATIC FUNCTIONS
+//=============================================================================
+
+// Ether, IP and UDP headers from the socket's template with the lengths and
+// IP checksum filled in
+static udpHeader* prepareUdpHeader(etherHeader* ether, socket* s, uint16_t dataSize) {
+    copySocketTxHeader(s, PROTOCOL_UDP, ether);
+    ipHeader* ip = (ipHeader*)ether->data;
+    uint8_t ipHeaderLength = ip->size * 4;
+    udpHeader* udp = (udpHeader*)((uint8_t*)ip + ipHeaderLength);
+    uint16_t udpLength = sizeof(udpHeader) + dataSize;
+    ip->length = htons(ipHeaderLength + udpLength);
+    udp->length = htons(udpLength);
+    // only the lengths differ from the template
+    ip->headerChecksum = getIpChecksum(s->txIpSum + ip->length);
+    return udp;
+}
 
 //=============================================================================
 // PUBLIC FUNCTIONS
@@ -37,15 +58,11 @@ bool isUdp(etherHeader *ether) {
     uint8_t ipHeaderLength = ip->size * 4;
     udpHeader *udp = (udpHeader*)((uint8_t*)ip + ipHeaderLength);
     bool ok;
-    uint16_t tmp16;
     uint32_t sum = 0;
     ok = (ip->protocol == PROTOCOL_UDP);
     if (ok) {
         // 32-bit sum over pseudo-header
-        sumIpWords(ip->sourceIp, 8, &sum);
-        tmp16 = ip->protocol;
-        sum += (tmp16 & 0xff) << 8;
-        sumIpWords(&udp->length, 2, &sum);
+        sumIpPseudoHeader(ip, ntohs(udp->length), &sum);
         // add udp header and data
         sumIpWords(udp, ntohs(udp->length), &sum);
         ok = (getIpChecksum(sum) == 0);
@@ -68,67 +85,30 @@ uint8_t* getUdpData(etherHeader *ether) {
     return udp->data;
 }
 
+// Builds a complete datagram (software checksum), returns the frame size
+uint16_t buildUdpMessage(etherHeader* ether, socket* s, uint8_t data[], uint16_t dataSize) {
+    udpHeader* udp = prepareUdpHeader(ether, s, dataSize);
+    // udp length appears in both the pseudo-header and the udp header
+    uint32_t sum = s->txL4Sum + udp->length + udp->length;
+    // copy data and sum it in one pass
+    copyIpWords(udp->data, data, dataSize, &sum);
+    udp->check = getIpChecksum(sum);
+    // size = ether + ip header + udp hdr + udp_size
+    return ((uint8_t*)udp - (uint8_t*)ether) + sizeof(udpHeader) + dataSize;
+}
+
 // Send UDP message
 void sendUdpMessage(etherHeader* ether, socket* s, uint8_t data[], uint16_t dataSize) {
-    uint16_t i;
-    uint32_t sum;
-    uint16_t tmp16;
-    uint16_t udpLength;
-    uint8_t *copyData;
-    uint8_t localHwAddress[6];
-    uint8_t localIpAddress[4];
-
-    // Ether frame
-    getEtherMacAddress(localHwAddress);
-    getIpAddress(localIpAddress);
-    for (i = 0; i < HW_ADD_LENGTH; i++) {
-        ether->destAddress[i] = s->remoteHwAddress[i]; //potentially use ARP table, socket kind of already does this.
-        ether->sourceAddress[i] = localHwAddress[i];
-    }
-    ether->frameType = htons(TYPE_IP);
-
-    // IP header
-    ipHeader* ip = (ipHeader*)ether->data;
-    ip->rev = 0x4;
-    ip->size = 0x5;
-    ip->typeOfService = 0;
-    ip->id = 0;
-    ip->flagsAndOffset = 0;
-    ip->ttl = 128;
-    ip->protocol = PROTOCOL_UDP;
-    ip->headerChecksum = 0;
-    for (i = 0; i < IP_ADD_LENGTH; i++)
-    {
-        ip->destIp[i] = s->remoteIpAddress[i];
-        ip->sourceIp[i] = localIpAddress[i];
+    udpHeader* udp;
+    uint16_t l4Offset;
+    if (!isNetifChecksumOffload()) {
+        putNetifPacket(ether, buildUdpMessage(ether, s, data, dataSize));
+        return;
     }
-    uint8_t ipHeaderLength = ip->size * 4;
-
-    // UDP header
-    udpHeader* udp = (udpHeader*)((uint8_t*)ip + (ip->size * 4));
-    udp->sourcePort = htons(s->localPort);
-    udp->destPort = htons(s->remotePort);
-    // adjust lengths
-    udpLength = sizeof(udpHeader) + dataSize;
-    ip->length = htons(ipHeaderLength + udpLength);
-    // 32-bit sum over ip header
-    calcIpChecksum(ip);
-    // set udp length
-    udp->length = htons(udpLength);
-    // copy data
-    copyData = udp->data;
-    for (i = 0; i < dataSize; i++)
-        copyData[i] = data[i];
-    // 32-bit sum over pseudo-header
-    sum = 0;
-    sumIpWords(ip->sourceIp, 8, &sum);
-    tmp16 = ip->protocol;
-    sum += (tmp16 & 0xff) << 8;
-    sumIpWords(&udp->length, 2, &sum);
-    // add udp header
-    udp->check = 0;
-    sumIpWords(udp, udpLength, &sum);
-    udp->check = getIpChecksum(sum);
-    // send packet with size = ether + udp hdr + ip header + udp_size
-    putEtherPacket(ether, sizeof(etherHeader) + ipHeaderLength + udpLength);
+    // controller sums the datagram once staged, seed it with the pseudo-header
+    udp = prepareUdpHeader(ether, s, dataSize);
+    l4Offset = (uint8_t*)udp - (uint8_t*)ether;
+    memcpy(udp->data, data, dataSize);
+    udp->check = ~getIpChecksum(s->txPseudoSum + udp->length);
+    putNetifPacketWithChecksum(ether, l4Offset + sizeof(udpHeader) + dataSize, l4Offset, l4Offset + offsetof(udpHeader, check));
 }
@@ -37,6 +37,8 @@
 /* Drivers */
 #include "tm4c123gh6pm.h"
 #include "clock.h"
+#include "timer.h"
+#include "scheduler.h"
 #include "gpio.h"
 #include "uart0.h"
 /* Libraries */
@@ -45,6 +47,8 @@
 #include "strlib.h"
 /* Applications */
 #include "network_stack.h"
+#include "netif.h"
+#include "arp.h"
 #include "shell.h"
 #include "sensors.h"
 
@@ -95,12 +99,18 @@ int main(void) {
     // Init timer
     initTimer();
 
+    // Select the ENC28J60 interface before anything reads the IP configuration
+    setNetif(getEtherNetif());
+
     // Init sockets
     initSockets();
 
+    // Init ARP cache (aging timer)
+    initArp();
+
     // Init ethernet interface (eth0)
     putsUart0("\nStarting eth0\n");
-    initEther(ETHER_UNICAST | ETHER_BROADCAST | ETHER_HALFDUPLEX);
+    initEther(ETHER_UNICAST | ETHER_BROADCAST | ETHER_HALFDUPLEX | ETHER_ASYNC_TX);
     setEtherMacAddress(0x02, 0x03, 0x04, 0x05, 0x06, 0xF6);
 
     // Init EEPROM
@@ -111,10 +121,17 @@ int main(void) {
     initMqttClient();
     setHandlePublishCallback(handlePublish);
 
+    // Main loop tasks, overrun limits are in cycles (40 per us)
+    initScheduler();
+    addTask("rx", SCHED_PRIORITY_RX, runNetworkRx, isNetifRxPending, 200000);
+    addTask("timers", SCHED_PRIORITY_TIMER, runTimers, isTimerPending, 40000);
+    addTask("tx", SCHED_PRIORITY_TX, runNetworkTx, NULL, 80000);
+    addTask("mqtt", SCHED_PRIORITY_APP, runMqttClient, NULL, 40000);
+    addTask("shell", SCHED_PRIORITY_SHELL, processShell, kbhitUart0, 400000);
+    setTaskReadyTime(runNetworkRx, getNetifRxEventTime); //rx latency from the INT edge
+
     while (true) {
-        processShell();
-        runNetworkStack();
-        runMqttClient();
+        runScheduler();
     }
 }
 
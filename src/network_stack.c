@@ -4,6 +4,11 @@
 #include "gpio.h"
 #include "uart0.h"
 #include "eth0.h"
+#include "netif.h"
+#include "clock.h"
+#include "packet.h"
+#include "profiler.h"
+#include "trace.h"
 #include "arp.h"
 #include "icmp.h"
 #include "dhcp.h"
@@ -12,6 +17,8 @@
 #include "tcp.h"
 #include "mqtt.h"
 #include "mqtt_client.h"
+#include "scheduler.h"
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -19,6 +26,15 @@ uint8_t buffer[MAX_PACKET_SIZE];
 uint8_t* udpData;
 socket s;
 char out[100];
+uint32_t overflowTime = 0;
+bool overflowLed = false;
+uint32_t earlyDrops = 0;
+uint8_t multicastGroups[MAX_MULTICAST_GROUPS][HW_ADD_LENGTH];
+uint8_t multicastGroupCount = 0;
+bool filterValid = false;
+bool filterBroadcast = false;
+uint16_t filterIpGeneration = 0;
+uint16_t announcedIpGeneration = 0;
 
 bool isNetworkReady() {
     uint8_t ip[4], gw[4], sn[4];
@@ -88,6 +104,37 @@ void netstat() {
     putsUart0("------------------------------------------------------------\n");
 }
 
+void stats() {
+    etherStats st;
+    arpStats arp;
+    getEtherStats(&st);
+    getArpStats(&arp);
+    putsUart0("\nEthernet Statistics\n------------------------------------------------------------\n");
+    snprintf(out, sizeof(out), "  RX interrupts:       %"PRIu32" (%"PRIu32" lost)\n", st.rxEvents, st.rxEventDrops);
+    putsUart0(out);
+    snprintf(out, sizeof(out), "  RX overflows:        %"PRIu32"\n", st.rxOverflows);
+    putsUart0(out);
+    snprintf(out, sizeof(out), "  RX resets:           %"PRIu32" (%"PRIu32" frames dropped)\n", st.rxResets, st.rxDrops);
+    putsUart0(out);
+    snprintf(out, sizeof(out), "  RX high-water:       %"PRIu8" frames\n", st.rxPacketsHighWater);
+    putsUart0(out);
+    snprintf(out, sizeof(out), "  Flow control events: %"PRIu32"\n", st.flowControlEvents);
+    putsUart0(out);
+    snprintf(out, sizeof(out), "  RX early drops:      %"PRIu32"\n", earlyDrops);
+    putsUart0(out);
+    snprintf(out, sizeof(out), "  ARP requests:        %"PRIu32" (%"PRIu32" callers coalesced)\n", arp.requests, arp.coalesced);
+    putsUart0(out);
+    snprintf(out, sizeof(out), "  ARP entries learned: %"PRIu32"\n", arp.learned);
+    putsUart0(out);
+    snprintf(out, sizeof(out), "  ARP refreshes:       %"PRIu32" (%"PRIu32" entries confirmed, %"PRIu32" dropped)\n",
+             arp.refreshes, arp.refreshed, arp.refreshFailed);
+    putsUart0(out);
+    snprintf(out, sizeof(out), "  ARP held frames:     %"PRIu32" (%"PRIu32" sent, %"PRIu32" timed out, %"PRIu32" overflowed)\n",
+             arp.pendingQueued, arp.pendingSent, arp.pendingTimeouts, arp.pendingOverflows);
+    putsUart0(out);
+    putsUart0("------------------------------------------------------------\n\n");
+}
+
 void readConfiguration() {
     uint32_t temp;
     uint8_t* ip;
@@ -136,81 +183,62 @@ void readConfiguration() {
     }
 }
 
-void processDhcpData(etherHeader* data) {
-    if (isIp(data)) {
-        if (!isIpUnicast(data)) {
-            if (isUdp(data)) {
-                if (isDhcpResponse(data)) {
-                    processDhcpResponse(data);
-                }
-            }
-        }
-    }
-}
-
-void processTcpData(etherHeader* data) {
+void processTcpData(packetInfo* pkt) {
     socket s;
-    if (isIp(data)) {
-        if (isIpUnicast(data)) {
-            if (isTcp(data)) {
-                if (isTcpPortOpen(data)) {
-                    processTcpResponse(data);
-                    //Layer 5-7 logic
-                    if (isMqttResponse(data)) {
-                        processMqttData(data);
-                    }
-                }
-                else {
-                    //maybe condense into socketRstTcp or something
-                    getSocketInfoFromTcpPacket(data, &s);
-                    tcpHeader* tcp = getTcpHeader(data);
-                    s.sequenceNumber = ntohl(tcp->acknowledgementNumber);
-                    s.acknowledgementNumber = ntohl(tcp->sequenceNumber) + getTcpDataLength(data);
-                    sendTcpResponse(data, &s, RST | ACK);
-                }
-            }
+    etherHeader* data = pkt->ether;
+    if (isTcpPortOpen(data)) {
+        processTcpResponse(data);
+        //Layer 5-7 logic
+        if (isMqttResponse(data)) {
+            processMqttData(data);
         }
     }
+    else {
+        //maybe condense into socketRstTcp or something
+        getSocketInfoFromTcpPacket(data, &s);
+        tcpHeader* tcp = getTcpHeader(data);
+        s.sequenceNumber = ntohl(tcp->acknowledgementNumber);
+        s.acknowledgementNumber = ntohl(tcp->sequenceNumber) + pkt->payloadLength;
+        sendTcpResponse(data, &s, RST | ACK);
+    }
 }
 
-void processUdpData(etherHeader* data) {
+void processUdpData(packetInfo* pkt) {
     socket s;
-    if (isIp(data)) {
-        if (isIpUnicast(data)) {
-            if (isUdp(data)) {
-                //Layer 5-7 logic
-                udpData = getUdpData(data);
-                if (strcmp((char*)udpData, "on") == 0)
-                    setPinValue(GREEN_LED, 1);
-                if (strcmp((char*)udpData, "off") == 0)
-                    setPinValue(GREEN_LED, 0);
-                getSocketInfoFromUdpPacket(data, &s);
-                sendUdpMessage(data, &s, (uint8_t*)"Received", 9);
-            }
-        }
-    }
+    etherHeader* data = pkt->ether;
+    //Layer 5-7 logic
+    udpData = pkt->payload;
+    if (strcmp((char*)udpData, "on") == 0)
+        setPinValue(GREEN_LED, 1);
+    if (strcmp((char*)udpData, "off") == 0)
+        setPinValue(GREEN_LED, 0);
+    getSocketInfoFromUdpPacket(data, &s);
+    sendUdpMessage(data, &s, (uint8_t*)"Received", 9);
 }
 
-void processIcmpData(etherHeader* data) {
-    if (isIp(data)) {
-        if (isIpUnicast(data)) {
-            icmpEchoResponse r;
-            if (isPingRequest(data)) {
-                sendPingResponse(data);
-            }
-            else if (isPingResponse(data, &r)) {
-                snprintf(out, MAX_UART_OUT, "Reply from %d.%d.%d.%d: bytes=%d time=%dms TTL=%d\n", r.remoteIp[0], r.remoteIp[1], r.remoteIp[2], r.remoteIp[3], r.bytes, r.ms, r.ttl);
-                putsUart0(out);
-            }
-        }
+void processIcmpData(packetInfo* pkt) {
+    etherHeader* data = pkt->ether;
+    icmpEchoResponse r;
+    if (isPingRequest(data)) {
+        sendPingResponse(data);
+    }
+    else if (isPingResponse(data, &r)) {
+        snprintf(out, MAX_UART_OUT, "Reply from %d.%d.%d.%d: bytes=%d time=%dms TTL=%d\n", r.remoteIp[0], r.remoteIp[1], r.remoteIp[2], r.remoteIp[3], r.bytes, r.ms, r.ttl);
+        putsUart0(out);
     }
 }
 
-void processArpData(etherHeader* data) {
-    if (isArpRequest(data)) {
+void processArpData(packetInfo* pkt) {
+    etherHeader* data = pkt->ether;
+    if (pkt->type == PACKET_ARP_REQUEST) {
+        learnArpSender(data); //before the response overwrites the sender fields
         sendArpResponse(data);
     }
-    if (isArpResponse(data)) {
+    else if (pkt->type == PACKET_ARP_OTHER) {
+        learnArpSender(data);
+        processDhcpArpResponse(data); //someone announcing the offered address is a conflict too
+    }
+    else {
         processArpResponse(data);
         processDhcpArpResponse(data);
         //processTcpArpResponse(data);
@@ -218,32 +246,138 @@ void processArpData(etherHeader* data) {
     }
 }
 
-
-
-void runNetworkStack() {
-    static etherHeader* data = (etherHeader*)buffer;
-    if (isDhcpEnabled()) {
-        sendDhcpPendingMessages(data); //for DHCP state machine
+// Validated IP traffic from a host on our subnet carries its MAC for free
+static void learnArpFromIp(packetInfo* pkt) {
+    ipHeader* ip = (ipHeader*)pkt->ether->data;
+    if (pkt->etherType == TYPE_IP && pkt->type != PACKET_DROP && pkt->ipChecksumOk && pkt->l4ChecksumOk) {
+        learnArpEntry(ip->sourceIp, pkt->ether->sourceAddress, true);
     }
-    sendTcpPendingMessages(data); //for TCP state machine
-    if (isEtherDataAvailable()) {
-        if (isEtherOverflow()) {
-            setPinValue(RED_LED, 1);
-            waitMicrosecond(100000);
-            setPinValue(RED_LED, 0);
-        }
-        getEtherPacket(data, MAX_PACKET_SIZE);
+}
 
-        processTcpData(data);
-        processArpData(data);
-        processIcmpData(data);
-        processUdpData(data);
+// Hands a classified frame to exactly one handler
+void dispatchPacket(packetInfo* pkt) {
+    switch (pkt->type) {
+    case PACKET_ARP_REQUEST:
+    case PACKET_ARP_RESPONSE:
+    case PACKET_ARP_OTHER:
+        PROFILE(PROFILE_ARP, processArpData(pkt));
+        break;
+    case PACKET_ICMP:
+        PROFILE(PROFILE_ICMP, processIcmpData(pkt));
+        break;
+    case PACKET_TCP:
+        PROFILE(PROFILE_TCP, processTcpData(pkt));
+        break;
+    case PACKET_UDP:
+        PROFILE(PROFILE_UDP, processUdpData(pkt));
+        break;
+    case PACKET_DHCP:
         if (isDhcpEnabled()) {
-            processDhcpData(data);
+            PROFILE(PROFILE_DHCP, processDhcpResponse(pkt->ether));
         }
+        break;
     }
 }
 
+// Asks the interface to pass only frames the stack can use: unicast to our
+// MAC, all ARP, joined multicast groups and broadcasts only while DHCP needs
+// them or we have no IP
+void updateReceiveFilter() {
+    uint8_t ip[IP_ADD_LENGTH];
+    getIpAddress(ip);
+    filterBroadcast = isDhcpBroadcastNeeded();
+    setNetifReceiveFilter(filterBroadcast || !isIpValid(ip),
+                          (const uint8_t (*)[HW_ADD_LENGTH])multicastGroups, multicastGroupCount);
+    filterIpGeneration = getIpAddressGeneration();
+    filterValid = true;
+}
 
+// Accepts frames sent to a multicast group address
+bool joinMulticastGroup(const uint8_t mac[HW_ADD_LENGTH]) {
+    if (multicastGroupCount == MAX_MULTICAST_GROUPS) {
+        return false;
+    }
+    copyMacAddress(multicastGroups[multicastGroupCount++], mac);
+    filterValid = false;
+    return true;
+}
 
+// Finishes transmits and sends whatever the DHCP and TCP state machines
+// have queued. Runs every pass, and keeps the next pass from sleeping while
+// async transmits are still waiting on the controller (tx completion does
+// not interrupt)
+void runNetworkTx() {
+    etherHeader* data = (etherHeader*)buffer;
+    pollNetif(); //finish async transmits
+    //recompute hardware filter when the IP address or DHCP state changes
+    if (!filterValid || filterIpGeneration != getIpAddressGeneration()
+            || filterBroadcast != isDhcpBroadcastNeeded()) {
+        updateReceiveFilter();
+    }
+    //tell the subnet whenever we take an address (DHCP bind or static)
+    if (announcedIpGeneration != getIpAddressGeneration()) {
+        announcedIpGeneration = getIpAddressGeneration();
+        if (isIpValid(getNetifIpConfig()->address)) {
+            sendGratuitousArp(data);
+        }
+    }
+    if (isDhcpEnabled()) {
+        PROFILE(PROFILE_DHCP_PENDING, sendDhcpPendingMessages(data)); //for DHCP state machine
+    }
+    PROFILE(PROFILE_TCP_PENDING, sendTcpPendingMessages(data)); //for TCP state machine
+    if (overflowLed && millis() - overflowTime >= OVERFLOW_LED_TIME) {
+        setPinValue(RED_LED, 0);
+        overflowLed = false;
+    }
+    if (isNetifTxBusy()) {
+        requestSchedulerPass();
+    }
+}
 
+// Drains up to MAX_RX_PACKETS_PER_PASS received frames
+void runNetworkRx() {
+    etherHeader* data = (etherHeader*)buffer;
+    packetInfo pkt;
+    uint16_t size;
+    uint8_t count;
+    uint16_t l4Offset, l4Length;
+    //INT line tells us when to look, no SPI polling while idle
+    if (isNetifRxPending()) {
+        //overflowed frames are already lost, keep draining instead of waiting
+        if (isNetifRxOverflow()) {
+            setPinValue(RED_LED, 1);
+            overflowTime = millis();
+            overflowLed = true;
+        }
+        count = getNetifPacketCount();
+        if (count > MAX_RX_PACKETS_PER_PASS) {
+            count = MAX_RX_PACKETS_PER_PASS; //rest are picked up next pass, INT stays low
+        }
+        while (count--) {
+            PROFILE_START(PROFILE_RX_FRAME);
+            //look at the headers first so unwanted frames never cross SPI
+            size = peekNetifPacket(data, PACKET_PEEK_SIZE);
+            if (size == 0) {
+                PROFILE_END(PROFILE_RX_FRAME);
+                break; //rx buffer was reset
+            }
+            if (!isPacketWanted(data, (size < PACKET_PEEK_SIZE) ? size : PACKET_PEEK_SIZE)) {
+                discardNetifPacket();
+                earlyDrops++;
+                PROFILE_END(PROFILE_RX_FRAME);
+                continue;
+            }
+            //let the controller checksum the payload before it is copied
+            pkt.hwChecksumValid = false;
+            if (isNetifChecksumOffload() && getPacketL4Range(data, (size < PACKET_PEEK_SIZE) ? size : PACKET_PEEK_SIZE, &l4Offset, &l4Length)) {
+                pkt.hwChecksumValid = getNetifRxChecksum(l4Offset, l4Length, &pkt.hwChecksum);
+            }
+            size = finishNetifPacket(data, MAX_PACKET_SIZE);
+            PROFILE_END(PROFILE_RX_FRAME);
+            recordTraceFrame(TRACE_RX_FRAME, data, size);
+            parsePacket(data, size, &pkt);
+            learnArpFromIp(&pkt);
+            dispatchPacket(&pkt);
+        }
+    }
+}
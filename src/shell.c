@@ -2,12 +2,17 @@
 #include "tm4c123gh6pm.h"
 #include "uart0.h"
 #include "eeprom.h"
+#include "clock.h"
 #include "eth0.h"
 #include "arp.h"
 #include "ip.h"
+#include "netif.h"
 #include "icmp.h"
 #include "dhcp.h"
 #include "mqtt_client.h"
+#include "scheduler.h"
+#include "profiler.h"
+#include "trace.h"
 #include "strlib.h"
 #include <inttypes.h>
 #include <network_stack.h>
@@ -16,8 +21,6 @@
 char strInput[MAX_CHARS+1];
 uint8_t count = 0;
 
-extern arp_entry_t arpTable[MAX_ARP_ENTRIES];
-
 uint8_t asciiToUint8(const char str[]) {
     uint8_t data;
     if (str[0] == '0' && to_lower(str[1]) == 'x')
@@ -32,7 +35,7 @@ void ipconfig() {
     char str[20];
     uint8_t mac[6];
     uint8_t ip[4];
-    getEtherMacAddress(mac);
+    getNetifMacAddress(mac);
     putsUart0("\nIP Configuration\n------------------------------------------------------------\n");
     putsUart0("  MAC:   ");
     for (i = 0; i < HW_ADD_LENGTH; i++)
@@ -120,13 +123,74 @@ void ipconfig() {
         snprintf(str, sizeof(str), "%"PRIu32"d:%02"PRIu32"h:%02"PRIu32"m\n", d, h, m);
         putsUart0(str);
     }
-    if (isEtherLinkUp())
+    if (isNetifLinkUp())
         putsUart0("  Link is up\n");
     else
         putsUart0("  Link is down\n");
     putsUart0("------------------------------------------------------------\n\n");
 }
 
+// Per task run time and scheduling latency, cycles shown as us (40 MHz)
+void sched() {
+    char out[100];
+    taskStats st;
+    uint8_t i;
+    putsUart0("\nTask      Pri  Runs        Avg us  Max us  Over  Lat us  Max lat  Defer\n");
+    putsUart0("------------------------------------------------------------------------\n");
+    for (i = 0; i < getTaskCount(); i++) {
+        getTaskStats(i, &st);
+        snprintf(out, sizeof(out), "%-8s  %-3"PRIu8"  %-10"PRIu32"  %-6"PRIu32"  %-6"PRIu32"  %-4"PRIu32"  %-6"PRIu32"  %-7"PRIu32"  %"PRIu32"\n",
+                 st.name, st.priority, st.runs,
+                 st.runs ? (uint32_t)(st.totalCycles / st.runs / 40) : 0, st.maxCycles / 40, st.overruns,
+                 st.runs ? (uint32_t)(st.totalLatency / st.runs / 40) : 0, st.maxLatency / 40, st.deferrals);
+        putsUart0(out);
+    }
+    snprintf(out, sizeof(out), "Idle passes: %"PRIu32"\n\n", getIdleCount());
+    putsUart0(out);
+}
+
+// Per stage min/avg/max and log2 histogram (bucket i starts at 2^(i+6))
+void perf() {
+    char out[100];
+    profileStats st;
+    uint8_t i, j;
+    if (!isProfileEnabled()) {
+        putsUart0("Profiling is not built in (PROFILE_ENABLED)\n");
+        return;
+    }
+    snprintf(out, sizeof(out), "\nStage      Count       Min       Avg       Max   (%"PRIu32" per us)\n", getProfileTicksPerUs());
+    putsUart0(out);
+    putsUart0("------------------------------------------------------------\n");
+    for (i = 0; i < PROFILE_STAGE_COUNT; i++) {
+        getProfileStats(i, &st);
+        snprintf(out, sizeof(out), "%-9s  %-10"PRIu32"  %-8"PRIu32"  %-8"PRIu32"  %-8"PRIu32"\n  ",
+                 st.name, st.count, st.min, st.count ? (uint32_t)(st.total / st.count) : 0, st.max);
+        putsUart0(out);
+        for (j = 0; j < PROFILE_HIST_BUCKETS; j++) {
+            snprintf(out, sizeof(out), " %"PRIu32, st.histogram[j]);
+            putsUart0(out);
+        }
+        putsUart0("\n");
+    }
+    putsUart0("\n");
+}
+
+// Oldest event first, one per line as time/type/a/b/c/d/e in hex
+// Paste the output into tools/trace_decode.py to get a timeline
+void trace() {
+    char out[60];
+    traceEvent ev;
+    uint16_t i;
+    snprintf(out, sizeof(out), "trace %d %"PRIu16" %"PRIu32" %"PRIu32"\n", TRACE_VERSION, getTraceCount(), getTraceTotal(), millis());
+    putsUart0(out);
+    for (i = 0; getTraceEvent(i, &ev); i++) {
+        snprintf(out, sizeof(out), "%08"PRIX32"%02"PRIX8"%02"PRIX8"%04"PRIX16"%04"PRIX16"%04"PRIX16"%08"PRIX32"\n",
+                 ev.time, ev.type, ev.a, ev.b, ev.c, ev.d, ev.e);
+        putsUart0(out);
+    }
+    putsUart0("end\n");
+}
+
 void processShell() {
     bool end;
     char c;
@@ -206,6 +270,36 @@ void processShell() {
             if (str_equal(token, "netstat")) {
                 netstat();
             }
+            if (str_equal(token, "stats")) {
+                stats();
+            }
+            if (str_equal(token, "perf")) {
+                token = str_tokenize(NULL, " ");
+                if (str_equal(token, "reset")) {
+                    resetProfile();
+                }
+                else {
+                    perf();
+                }
+            }
+            if (str_equal(token, "sched")) {
+                token = str_tokenize(NULL, " ");
+                if (str_equal(token, "reset")) {
+                    resetSchedulerStats();
+                }
+                else {
+                    sched();
+                }
+            }
+            if (str_equal(token, "trace")) {
+                token = str_tokenize(NULL, " ");
+                if (str_equal(token, "clear")) {
+                    clearTrace();
+                }
+                else {
+                    trace();
+                }
+            }
             if (str_equal(token, "arp")) {
                 token = str_tokenize(NULL, " ");
                 if (str_equal(token, "clear")) {
@@ -293,9 +387,13 @@ void processShell() {
                 putsUart0("                   |subscribe TOPIC|unsubscribe TOPIC}\n");
                 putsUart0("  ipconfig\n");
                 putsUart0("  netstat\n");
+                putsUart0("  perf [reset]\n");
                 putsUart0("  ping w.x.y.z\n");
                 putsUart0("  reboot\n");
+                putsUart0("  sched [reset]\n");
                 putsUart0("  set ip|gw|dns|time|mqtt|sn w.x.y.z\n");
+                putsUart0("  stats\n");
+                putsUart0("  trace [clear]\n");
             }
         }
     }
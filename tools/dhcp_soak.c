@@ -0,0 +1,349 @@
+/******************************************************************************
+ * File:        dhcp_soak.c
+ *
+ * Author:      Giancarlo Perez
+ *
+ * Created:     10/17/26
+ *
+ * Description: Soak test of the DHCP client on the timer virtual clock. The
+ *              stack runs on a queue interface with DHCP enabled and this
+ *              tool plays the DHCP server on the other end, handing out a
+ *              short lease (120 s by default, T1 at half, T2 at 7/8) and
+ *              ignoring the first REQUEST of every tenth renewal so the
+ *              retry timer gets used. Time jumps straight to the next timer
+ *              deadline, so a day of leases takes well under a second.
+ *
+ *              Checks that after the first bind the lease never lapses (the
+ *              client stays BOUND or RENEWING with the same address), that
+ *              renewals do not bump the address generation, that every
+ *              renewal leaves the same number of free timers (no leaked
+ *              handles), and that the expected number of renewals happened.
+ *              Exits non-zero on failure.
+ *
+ *              gcc -std=gnu99 -O2 -fgnu89-inline -fcommon -DTIMER_VIRTUAL_CLOCK \
+ *                  -DNETIF_QUEUE_SIZE=8 -Iinclude tools/dhcp_soak.c \
+ *                  tools/host_stubs.c middleware/[a-z]*.c libs/timer.c libs/trace.c \
+ *                  libs/profiler.c libs/strlib.c libs/mqtt_client.c \
+ *                  src/network_stack.c -o dhcp_soak
+ *              ./dhcp_soak [hours] [lease seconds]
+ ******************************************************************************/
+
+#define _POSIX_C_SOURCE 199309L
+
+//=============================================================================
+// INCLUDES
+//=============================================================================
+
+#include "netif.h"
+#include "ip.h"
+#include "arp.h"
+#include "udp.h"
+#include "socket.h"
+#include "dhcp.h"
+#include "timer.h"
+#include "clock.h"
+#include "network_stack.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//=============================================================================
+// DEFINES AND MACROS
+//=============================================================================
+
+#define DEFAULT_HOURS       24
+#define DEFAULT_LEASE       120     // seconds
+
+#define IGNORE_EVERY        10      // renewals
+#define IGNORE_REQUESTS     1       // requests ignored on those renewals
+
+#define RENEW_RETRY_S       15      // client sends REQUESTs this often after T1
+
+#define BIND_TIMEOUT_MS     60000
+
+#define FAIL(...) do { printf("FAIL at %u s: ", (unsigned)(systime / 1000)); printf(__VA_ARGS__); printf("\n"); return false; } while (0)
+
+//=============================================================================
+// TYPEDEFS AND GLOBALS
+//=============================================================================
+
+typedef struct _soakStats {
+    uint32_t discovers;
+    uint32_t requests;
+    uint32_t ignored;
+    uint32_t offers;
+    uint32_t acks;
+    uint32_t otherFrames;
+    uint32_t steps;
+} soakStats;
+
+static const uint8_t stackMac[HW_ADD_LENGTH] = {0x02, 0x03, 0x04, 0x05, 0x06, 0xF6};
+static const uint8_t serverMac[HW_ADD_LENGTH] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+static const uint8_t serverIp[IP_ADD_LENGTH] = {192, 168, 1, 1};
+static const uint8_t leasedIp[IP_ADD_LENGTH] = {192, 168, 1, 50};
+static const uint8_t subnetMask[IP_ADD_LENGTH] = {255, 255, 255, 0};
+
+static netif stackIf, serverIf;
+static netifQueue stackQueue, serverQueue;
+
+static uint8_t frame[MAX_PACKET_SIZE];
+static uint8_t reply[MAX_PACKET_SIZE];
+
+static uint32_t leaseSecondsGranted = DEFAULT_LEASE;
+static uint32_t renewalsIgnoring = 0;   // requests left to ignore this renewal
+static soakStats soak;
+
+//=============================================================================
+// SERVER (peer side)
+//=============================================================================
+
+static uint8_t* addOption(uint8_t* p, uint8_t type, uint8_t length, const void* data) {
+    *p++ = type;
+    *p++ = length;
+    memcpy(p, data, length);
+    return p + length;
+}
+
+static uint8_t* addOption32(uint8_t* p, uint8_t type, uint32_t value) {
+    uint32_t n = htonl(value);
+    return addOption(p, type, 4, &n);
+}
+
+// Returns the value of a one byte option, 0 if it is missing
+static uint8_t getOption8(dhcpFrame* dhcp, uint16_t size, uint8_t type) {
+    uint8_t* p = dhcp->options;
+    uint8_t* end = (uint8_t*)dhcp + size;
+    while (p + 1 < end && *p != DHCP_OPTION_END_MARK) {
+        if (*p == type) {
+            return p[2];
+        }
+        p += 2 + p[1];
+    }
+    return 0;
+}
+
+// Answers a DISCOVER or REQUEST, broadcast as the client asks for
+static void sendServerReply(dhcpFrame* request, uint8_t type) {
+    etherHeader* ether = (etherHeader*)reply;
+    ipHeader* ip = (ipHeader*)ether->data;
+    udpHeader* udp = (udpHeader*)ip->data;
+    dhcpFrame* dhcp = (dhcpFrame*)udp->data;
+    uint8_t* p;
+    uint16_t dhcpSize, udpSize;
+    uint32_t sum = 0;
+
+    memset(reply, 0, sizeof(reply));
+    memcpy(dhcp, request, sizeof(dhcpFrame));
+    dhcp->op = 2;
+    memcpy(dhcp->yiaddr, leasedIp, IP_ADD_LENGTH);
+    memcpy(dhcp->siaddr, serverIp, IP_ADD_LENGTH);
+    p = dhcp->options;
+    p = addOption(p, DHCP_OPTION_DHCP_TYPE, 1, &type);
+    p = addOption(p, DHCP_OPTION_SERVER_ID, IP_ADD_LENGTH, serverIp);
+    p = addOption32(p, DHCP_OPTION_LEASE_TIME, leaseSecondsGranted);
+    p = addOption32(p, DHCP_OPTION_RENEW_TIME, leaseSecondsGranted / 2);
+    p = addOption32(p, DHCP_OPTION_REBIND_TIME, leaseSecondsGranted / 8 * 7);
+    p = addOption(p, DHCP_OPTION_SUBNET_MASK, IP_ADD_LENGTH, subnetMask);
+    p = addOption(p, DHCP_OPTION_DEFAULT_GATEWAY, IP_ADD_LENGTH, serverIp);
+    p = addOption(p, DHCP_OPTION_DNS_SERVER, IP_ADD_LENGTH, serverIp);
+    *p++ = DHCP_OPTION_END_MARK;
+    dhcpSize = p - (uint8_t*)dhcp;
+    udpSize = sizeof(udpHeader) + dhcpSize;
+
+    memset(ether->destAddress, 0xFF, HW_ADD_LENGTH);
+    memcpy(ether->sourceAddress, serverMac, HW_ADD_LENGTH);
+    ether->frameType = htons(TYPE_IP);
+    ip->rev = 4;
+    ip->size = 5;
+    ip->length = htons(sizeof(ipHeader) + udpSize);
+    ip->ttl = 64;
+    ip->protocol = PROTOCOL_UDP;
+    memcpy(ip->sourceIp, serverIp, IP_ADD_LENGTH);
+    memset(ip->destIp, 0xFF, IP_ADD_LENGTH);
+    calcIpChecksum(ip);
+    udp->sourcePort = htons(DHCP_SOURCE_PORT_S);
+    udp->destPort = htons(DHCP_DEST_PORT_S);
+    udp->length = htons(udpSize);
+    udp->check = 0;
+    sumIpPseudoHeader(ip, udpSize, &sum);
+    sumIpWords(udp, udpSize, &sum);
+    udp->check = getIpChecksum(sum);
+    serverIf.ops->tx(&serverIf, ether, sizeof(etherHeader) + sizeof(ipHeader) + udpSize);
+}
+
+// Handles every frame the stack sent, returns true if any were waiting
+static bool runServer(void) {
+    etherHeader* ether = (etherHeader*)frame;
+    ipHeader* ip = (ipHeader*)ether->data;
+    udpHeader* udp;
+    dhcpFrame* dhcp;
+    uint16_t size;
+    bool any = false;
+    while (serverIf.ops->isRxPending(&serverIf)) {
+        any = true;
+        serverIf.ops->peek(&serverIf, ether, 0);
+        size = serverIf.ops->finish(&serverIf, ether, MAX_PACKET_SIZE);
+        udp = (udpHeader*)((uint8_t*)ip + ip->size * 4);
+        if (ntohs(ether->frameType) != TYPE_IP || ip->protocol != PROTOCOL_UDP
+                || ntohs(udp->destPort) != DHCP_DEST_PORT_C) {
+            soak.otherFrames++;    // gratuitous ARP after each bind
+            continue;
+        }
+        dhcp = (dhcpFrame*)udp->data;
+        size -= (uint8_t*)dhcp - frame;
+        switch (getOption8(dhcp, size, DHCP_OPTION_DHCP_TYPE)) {
+        case DHCPDISCOVER:
+            soak.discovers++;
+            soak.offers++;
+            sendServerReply(dhcp, DHCPOFFER);
+            break;
+        case DHCPREQUEST:
+            soak.requests++;
+            if (renewalsIgnoring > 0) {
+                renewalsIgnoring--;
+                soak.ignored++;
+                break;
+            }
+            soak.acks++;
+            sendServerReply(dhcp, DHCPACK);
+            if (soak.acks % IGNORE_EVERY == 0) {
+                renewalsIgnoring = IGNORE_REQUESTS;
+            }
+            break;
+        default:
+            soak.otherFrames++;
+            break;
+        }
+    }
+    return any;
+}
+
+//=============================================================================
+// STACK
+//=============================================================================
+
+static void initStack(void) {
+    initQueueNetif(&stackIf, "host0", &stackQueue, stackMac);
+    initQueueNetif(&serverIf, "server", &serverQueue, serverMac);
+    connectQueueNetifs(&stackIf, &serverIf);
+    setNetif(&stackIf);
+    seedRandom32(1);
+    initTimer();
+    initSockets();
+    initArp();
+    enableDhcp();
+}
+
+// Runs the stack and the server until neither has anything left to do
+static void settle(void) {
+    do {
+        runNetworkRx();
+        runNetworkTx();
+    } while (runServer());
+}
+
+// Counts timers that can still be started, by taking them all and giving
+// them back
+static uint8_t countFreeTimers(void) {
+    uint16_t taken[NUM_TIMERS];
+    uint8_t count = 0, i;
+    while (count < NUM_TIMERS && (taken[count] = startOneshotTimer(NULL, 3600, NULL)) != INVALID_TIMER) {
+        count++;
+    }
+    for (i = 0; i < count; i++) {
+        stopTimer(taken[i]);
+    }
+    return count;
+}
+
+static bool runSoak(uint32_t hours) {
+    uint32_t end = hours * 3600000u;
+    uint32_t expectedAcks;
+    uint32_t acks = 0;
+    uint16_t generation;
+    uint8_t freeTimers;
+    uint8_t ip[IP_ADD_LENGTH];
+    uint8_t state;
+
+    // first bind
+    settle();
+    while (getDhcpState() != DHCP_BOUND) {
+        if (systime > BIND_TIMEOUT_MS || runToNextTimer() == 0) {
+            FAIL("no lease after %u discovers", soak.discovers);
+        }
+        settle();
+    }
+    generation = getIpAddressGeneration();
+    freeTimers = countFreeTimers();
+    acks = soak.acks;
+
+    while (systime < end) {
+        if (runToNextTimer() == 0) {
+            FAIL("no timers running");
+        }
+        soak.steps++;
+        settle();
+        state = getDhcpState();
+        getIpAddress(ip);
+        if (state != DHCP_BOUND && state != DHCP_RENEWING) {
+            FAIL("lease lapsed, state %u", state);
+        }
+        if (!isIpEqual(ip, (uint8_t*)leasedIp)) {
+            FAIL("address changed to %u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+        }
+        if (getIpAddressGeneration() != generation) {
+            FAIL("renewal bumped the address generation (%u -> %u)", generation, getIpAddressGeneration());
+        }
+        if (soak.acks != acks) {
+            acks = soak.acks;
+            if (countFreeTimers() != freeTimers) {
+                FAIL("%u free timers after renewal %u, %u after the first bind",
+                     countFreeTimers(), acks - 1, freeTimers);
+            }
+        }
+    }
+    if (soak.discovers != 1) {
+        FAIL("%u discovers, the lease was lost", soak.discovers);
+    }
+    // the first REQUEST goes out one retry period after T1, a renewal with
+    // an ignored request takes one more
+    expectedAcks = end / ((leaseSecondsGranted / 2 + RENEW_RETRY_S) * 1000);
+    if (soak.acks < expectedAcks * 9 / 10 || soak.acks > expectedAcks + 2) {
+        FAIL("%u acks, expected about %u", soak.acks, expectedAcks);
+    }
+    printf("free timers:      %u (steady)\n", freeTimers);
+    return true;
+}
+
+static double nowMs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+//=============================================================================
+// PUBLIC FUNCTIONS
+//=============================================================================
+
+int main(int argc, char* argv[]) {
+    uint32_t hours = (argc > 1) ? strtoul(argv[1], NULL, 0) : DEFAULT_HOURS;
+    double start;
+    bool ok;
+
+    if (argc > 2) {
+        leaseSecondsGranted = strtoul(argv[2], NULL, 0);
+    }
+    if (hours == 0 || leaseSecondsGranted < 96) {
+        printf("usage: %s [hours] [lease seconds >= 96]\n", argv[0]);
+        return 2;
+    }
+    initStack();
+    start = nowMs();
+    ok = runSoak(hours);
+    printf("simulated:        %u h, %u s leases\n", hours, leaseSecondsGranted);
+    printf("wall time:        %.0f ms over %u timer deadlines\n", nowMs() - start, soak.steps);
+    printf("server:           %u discovers, %u requests (%u ignored), %u acks, %u other frames\n",
+           soak.discovers, soak.requests, soak.ignored, soak.acks, soak.otherFrames);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,597 @@
+/******************************************************************************
+ * File:        enc28j60_model.c
+ *
+ * Author:      Giancarlo Perez
+ *
+ * Created:     10/17/26
+ *
+ * Description: Host model of the ENC28J60 as drivers/eth0.c sees it. Stands
+ *              in for spi0.c, the gpio pins eth0.c uses (~CS, RESET, INT),
+ *              wait and the cycle counter, so eth0.c can be built unchanged
+ *              for the host (-Itools/host ahead of -Iinclude).
+ *
+ *              Modelled: the SPI opcodes (RCR, WCR, BFS, BFC, RBM, WBM, SRC)
+ *              with bank selection, the 8 KB buffer memory with ERDPT
+ *              wrapping from ERXND to ERXST, frame reception into the rx
+ *              ring (header, frame, crc, EPKTCNT, overflow), transmission
+ *              from ETXST..ETXND with a status vector, aborts and TXRST,
+ *              the DMA checksum engine, MII reads and writes, and the INT
+ *              line from EIE/EIR.
+ *
+ *              Not modelled: the dummy byte the real part returns before
+ *              MAC and MII register reads, receive filters, DMA copy mode
+ *              and timing beyond a configurable number of ECON1 reads a
+ *              frame stays on the wire.
+ *
+ *              Every chip select is logged with its byte count and opcode,
+ *              so tests can count SPI transactions and bytes per call.
+ *              spi0.c is replaced at its function boundary, a block call is
+ *              clocked byte by byte into the same transaction.
+ ******************************************************************************/
+
+//=============================================================================
+// INCLUDES
+//=============================================================================
+
+#include "enc28j60_model.h"
+#include "tm4c123gh6pm.h"
+#include "gpio.h"
+#include "spi0.h"
+#include "wait.h"
+#include "clock.h"
+#include <string.h>
+
+//=============================================================================
+// DEFINES AND MACROS
+//=============================================================================
+
+#define MEM_SIZE    0x2000
+
+/* Registers, bank in bits 6:5 as in eth0.c, common ones (0x1B-0x1F) in bank 0 */
+#define ERDPTL      0x00
+#define EWRPTL      0x02
+#define ETXSTL      0x04
+#define ETXNDL      0x06
+#define ERXSTL      0x08
+#define ERXNDL      0x0A
+#define ERXRDPTL    0x0C
+#define ERXWRPTL    0x0E
+#define EDMASTL     0x10
+#define EDMANDL     0x12
+#define EDMACSL     0x16
+#define EDMACSH     0x17
+#define EIE         0x1B
+#define INTIE   0x80
+#define EIR         0x1C
+#define RXERIF  0x01
+#define TXERIF  0x02
+#define TXIF    0x08
+#define PKTIF   0x40
+#define ESTAT       0x1D
+#define CLKRDY  0x01
+#define TXABORT 0x02
+#define ECON2       0x1E
+#define PKTDEC  0x40
+#define AUTOINC 0x80
+#define ECON1       0x1F
+#define BSEL    0x03
+#define RXEN    0x04
+#define TXRTS   0x08
+#define CSUMEN  0x10
+#define DMAST   0x20
+#define TXRST   0x80
+#define EPKTCNT     0x39
+#define MICMD       0x52
+#define MIIRD   0x01
+#define MIREGADR    0x54
+#define MIWRL       0x56
+#define MIWRH       0x57
+#define MIRDL       0x58
+#define MIRDH       0x59
+#define MISTAT      0x6A
+
+#define PHSTAT1     0x01
+#define LSTAT  0x0400
+
+#define RX_OK       0x80    // received ok, bit 23 of the receive status vector
+#define TX_DONE     0x80    // transmit done, bit 23 of the transmit status vector
+
+//=============================================================================
+// TYPEDEFS AND GLOBALS
+//=============================================================================
+
+encSpiLog encSpi;
+encTxFrame encTx[ENC_TX_LOG_SIZE];
+uint8_t encTxCount = 0;
+uint32_t encTxResets = 0;
+uint8_t encTxWireReads = 0;
+bool encTxAbortNext = false;
+bool encLinkUp = true;
+uint32_t encBaudRate = 0;
+uint32_t encCycles = 0;
+
+volatile uint32_t hostNvicEn0 = 0;
+
+static uint8_t mem[MEM_SIZE];
+static uint8_t regs[128];
+static uint16_t phy[32];
+static uint32_t cyclesPerByte = 32;
+
+static bool selected = false;
+static uint16_t byteIndex = 0;      // byte in the current transaction
+static uint8_t opcode = 0;
+static uint8_t response = 0;        // byte clocked back on the last write
+
+static bool txOnWire = false;
+static uint8_t txReadsLeft = 0;
+
+//=============================================================================
+// STATIC FUNCTIONS
+//=============================================================================
+
+static uint16_t getReg16(uint8_t reg) {
+    return regs[reg] | (regs[reg + 1] << 8);
+}
+
+static void setReg16(uint8_t reg, uint16_t value) {
+    regs[reg] = value & 0xFF;
+    regs[reg + 1] = value >> 8;
+}
+
+static void resetRegisters(void) {
+    memset(regs, 0, sizeof(regs));
+    memset(phy, 0, sizeof(phy));
+    regs[ECON2] = AUTOINC;
+    setReg16(ERDPTL, 0x05FA);
+    setReg16(ERXNDL, 0x1FFF);
+    setReg16(ERXRDPTL, 0x05FA);
+    txOnWire = false;
+}
+
+// Full address of a register in the current bank
+static uint8_t getRegAddress(uint8_t add) {
+    add &= 0x1F;
+    return (add >= EIE) ? add : (((regs[ECON1] & BSEL) << 5) | add);
+}
+
+static bool isInRxBuffer(uint16_t add) {
+    return add >= getReg16(ERXSTL) && add <= getReg16(ERXNDL);
+}
+
+// Next address for reads and the DMA, which wrap inside the rx buffer
+static uint16_t getNextReadAddress(uint16_t add) {
+    if (add == getReg16(ERXNDL)) {
+        return getReg16(ERXSTL);
+    }
+    return (add + 1) & (MEM_SIZE - 1);
+}
+
+static uint16_t getRxFreeSpace(void) {
+    uint16_t wr = getReg16(ERXWRPTL);
+    uint16_t rd = getReg16(ERXRDPTL);
+    uint16_t len = getReg16(ERXNDL) - getReg16(ERXSTL);
+    if (wr > rd) {
+        return len - (wr - rd);
+    }
+    if (wr == rd) {
+        return len;
+    }
+    return rd - wr - 1;
+}
+
+static uint8_t getEir(void) {
+    uint8_t eir = regs[EIR] & ~PKTIF;
+    if (regs[EPKTCNT] != 0) {
+        eir |= PKTIF;
+    }
+    return eir;
+}
+
+static void finishTx(void) {
+    uint16_t start = getReg16(ETXSTL);
+    uint16_t end = getReg16(ETXNDL);
+    uint16_t size = end - start;
+    uint16_t i;
+    encTxFrame* f = &encTx[encTxCount % ENC_TX_LOG_SIZE];
+    f->start = start;
+    f->size = size;
+    f->aborted = encTxAbortNext;
+    for (i = 0; i < size && i < ENC_MAX_FRAME; i++) {
+        f->data[i] = mem[(start + 1 + i) & (MEM_SIZE - 1)];
+    }
+    encTxCount++;
+
+    // status vector follows the frame
+    for (i = 0; i < 7; i++) {
+        mem[(end + 1 + i) & (MEM_SIZE - 1)] = 0;
+    }
+    mem[(end + 1) & (MEM_SIZE - 1)] = size & 0xFF;
+    mem[(end + 2) & (MEM_SIZE - 1)] = size >> 8;
+    mem[(end + 3) & (MEM_SIZE - 1)] = TX_DONE;
+
+    if (encTxAbortNext) {
+        regs[ESTAT] |= TXABORT;
+        regs[EIR] |= TXERIF;
+    }
+    else {
+        regs[ESTAT] &= ~TXABORT;
+    }
+    regs[EIR] |= TXIF;
+    regs[ECON1] &= ~TXRTS;
+    encTxAbortNext = false;
+    txOnWire = false;
+}
+
+// Runs the checksum engine over EDMAST..EDMAND (inclusive), the datasheet
+// sum of big-endian 16-bit words, odd last byte padded with zero
+// As in Microchip's reference driver, the byte of the result that goes first
+// on the wire is left in EDMACSH
+static void runDmaChecksum(void) {
+    uint16_t add = getReg16(EDMASTL);
+    uint16_t end = getReg16(EDMANDL);
+    uint32_t sum = 0;
+    bool high = true;
+    uint16_t csum;
+    for (;;) {
+        sum += high ? (mem[add] << 8) : mem[add];
+        high = !high;
+        if (add == end) {
+            break;
+        }
+        add = isInRxBuffer(getReg16(EDMASTL)) ? getNextReadAddress(add) : ((add + 1) & (MEM_SIZE - 1));
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    csum = ~sum;
+    regs[EDMACSH] = csum >> 8;
+    regs[EDMACSL] = csum & 0xFF;
+}
+
+// Writes a register and applies the side effects of the write
+static void writeReg(uint8_t reg, uint8_t value) {
+    uint8_t old = regs[reg];
+    if (reg == EIR) {
+        value &= ~PKTIF;    // read only
+    }
+    regs[reg] = value;
+    switch (reg) {
+    case ECON1:
+        if ((value & TXRST) && !(old & TXRST)) {
+            encTxResets++;
+            txOnWire = false;
+            regs[ECON1] &= ~TXRTS;
+        }
+        if ((value & TXRTS) && !(old & TXRTS) && !(value & TXRST)) {
+            txOnWire = true;
+            txReadsLeft = encTxWireReads;
+        }
+        if ((value & DMAST) && !(old & DMAST)) {
+            if (value & CSUMEN) {
+                runDmaChecksum();
+            }
+            regs[ECON1] &= ~DMAST;
+        }
+        break;
+    case ECON2:
+        if ((value & PKTDEC) && regs[EPKTCNT] != 0) {
+            regs[EPKTCNT]--;
+        }
+        regs[ECON2] &= ~PKTDEC;
+        break;
+    case MICMD:
+        if (value & MIIRD) {
+            uint16_t data = phy[regs[MIREGADR] & 0x1F];
+            if ((regs[MIREGADR] & 0x1F) == PHSTAT1) {
+                data = encLinkUp ? LSTAT : 0;
+            }
+            setReg16(MIRDL, data);
+        }
+        break;
+    case MIWRH:
+        phy[regs[MIREGADR] & 0x1F] = regs[MIWRL] | (value << 8);
+        break;
+    }
+}
+
+static uint8_t readReg(uint8_t reg) {
+    switch (reg) {
+    case ECON1:
+        if (txOnWire) {
+            if (txReadsLeft == 0) {
+                finishTx();
+            }
+            else {
+                txReadsLeft--;
+            }
+        }
+        break;
+    case EIR:
+        return getEir();
+    case ESTAT:
+        return regs[ESTAT] | CLKRDY;
+    case MISTAT:
+        return 0;   // never busy
+    }
+    return regs[reg];
+}
+
+// Clocks one byte through the current transaction, returns the byte clocked back
+static uint8_t clockByte(uint8_t data) {
+    uint8_t out = 0;
+    uint16_t add;
+    encCycles += cyclesPerByte;
+    if (!selected) {
+        encSpi.stray++;
+        return 0;
+    }
+    encSpi.bytes++;
+    if (byteIndex++ == 0) {
+        opcode = data;
+        if (opcode == ENC_OP_SRC) {
+            resetRegisters();
+        }
+        return 0;
+    }
+    switch (opcode & 0xE0) {
+    case ENC_OP_RCR:
+        out = readReg(getRegAddress(opcode));
+        break;
+    case ENC_OP_RBM & 0xE0:
+        add = getReg16(ERDPTL);
+        out = mem[add];
+        setReg16(ERDPTL, getNextReadAddress(add));
+        break;
+    case ENC_OP_WCR:
+        writeReg(getRegAddress(opcode), data);
+        break;
+    case ENC_OP_WBM & 0xE0:
+        add = getReg16(EWRPTL);
+        mem[add] = data;
+        setReg16(EWRPTL, (add + 1) & (MEM_SIZE - 1));
+        break;
+    case ENC_OP_BFS:
+        add = getRegAddress(opcode);
+        writeReg(add, regs[add] | data);
+        break;
+    case ENC_OP_BFC:
+        add = getRegAddress(opcode);
+        writeReg(add, (add == EIR ? getEir() : regs[add]) & ~data);
+        break;
+    }
+    return out;
+}
+
+static void endTransaction(void) {
+    uint8_t op = opcode;
+    if ((op & 0xE0) == (ENC_OP_RBM & 0xE0)) {
+        op = ENC_OP_RBM;
+    }
+    else if ((op & 0xE0) == (ENC_OP_WBM & 0xE0)) {
+        op = ENC_OP_WBM;
+    }
+    else if (op != ENC_OP_SRC) {
+        op &= 0xE0;
+    }
+    if (encSpi.logged < ENC_SPI_LOG_SIZE) {
+        encSpi.size[encSpi.logged] = byteIndex;
+        encSpi.opcode[encSpi.logged] = op;
+        encSpi.logged++;
+    }
+    encSpi.transactions++;
+}
+
+static uint32_t getCrc32(const uint8_t data[], uint16_t size) {
+    uint32_t crc = 0xFFFFFFFF;
+    uint16_t i;
+    uint8_t j;
+    for (i = 0; i < size; i++) {
+        crc ^= data[i];
+        for (j = 0; j < 8; j++) {
+            crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320 : 0);
+        }
+    }
+    return ~crc;
+}
+
+//=============================================================================
+// PUBLIC FUNCTIONS
+//=============================================================================
+
+// Powers up the model with empty buffer memory and logs
+void resetEnc28j60Model(void) {
+    memset(mem, 0, sizeof(mem));
+    memset(&encSpi, 0, sizeof(encSpi));
+    memset(encTx, 0, sizeof(encTx));
+    encTxCount = 0;
+    encTxResets = 0;
+    encTxWireReads = 0;
+    encTxAbortNext = false;
+    encLinkUp = true;
+    selected = false;
+    resetRegisters();
+}
+
+void clearEnc28j60SpiLog(void) {
+    memset(&encSpi, 0, sizeof(encSpi));
+}
+
+// Returns number of logged transactions that started with opcode
+// (register bits cleared, e.g. ENC_OP_WCR)
+uint32_t countEnc28j60Transactions(uint8_t op) {
+    uint32_t i, count = 0;
+    for (i = 0; i < encSpi.logged; i++) {
+        if (encSpi.opcode[i] == op) {
+            count++;
+        }
+    }
+    return count;
+}
+
+// Receives a frame from the wire (crc is added), as the controller would
+// Returns false if reception is off or the frame did not fit (RXERIF set)
+bool injectEnc28j60Frame(const uint8_t frame[], uint16_t size) {
+    uint16_t start = getReg16(ERXSTL);
+    uint16_t len = getReg16(ERXNDL) - start + 1;
+    uint16_t wr = getReg16(ERXWRPTL);
+    uint16_t count = size + 4;
+    uint16_t need = (6 + count + 1) & ~1;
+    uint16_t next, add, i;
+    uint32_t crc;
+    uint8_t header[6];
+    if (!(regs[ECON1] & RXEN)) {
+        return false;
+    }
+    if (need > getRxFreeSpace() || regs[EPKTCNT] == 0xFF) {
+        regs[EIR] |= RXERIF;
+        return false;
+    }
+    next = start + (wr - start + need) % len;
+    header[0] = next & 0xFF;
+    header[1] = next >> 8;
+    header[2] = count & 0xFF;
+    header[3] = count >> 8;
+    header[4] = RX_OK;
+    header[5] = 0;
+    crc = getCrc32(frame, size);
+    add = wr;
+    for (i = 0; i < 6 + count; i++) {
+        if (i < 6) {
+            mem[add] = header[i];
+        }
+        else if (i < 6 + size) {
+            mem[add] = frame[i - 6];
+        }
+        else {
+            mem[add] = (crc >> (8 * (i - 6 - size))) & 0xFF;
+        }
+        add = getNextReadAddress(add);
+    }
+    setReg16(ERXWRPTL, next);
+    regs[EPKTCNT]++;
+    return true;
+}
+
+uint8_t readEnc28j60Mem(uint16_t add) {
+    return mem[add & (MEM_SIZE - 1)];
+}
+
+// Reads a register without side effects (address as in eth0.c)
+uint8_t readEnc28j60Reg(uint8_t reg) {
+    return (reg == EIR) ? getEir() : regs[reg];
+}
+
+uint8_t getEnc28j60PacketCount(void) {
+    return regs[EPKTCNT];
+}
+
+// Returns true if the INT line is driven low
+bool isEnc28j60IntAsserted(void) {
+    return (regs[EIE] & INTIE) && (getEir() & regs[EIE] & 0x7B);
+}
+
+/* spi0.c */
+
+void initSpi0(uint32_t pinMask) {
+    (void)pinMask;
+}
+
+void setSpi0BaudRate(uint32_t clockRate, uint32_t fcyc) {
+    encBaudRate = clockRate;
+    cyclesPerByte = 8 * (fcyc / clockRate);
+}
+
+void setSpi0Mode(uint8_t polarity, uint8_t phase) {
+    (void)polarity;
+    (void)phase;
+}
+
+void writeSpi0Data(uint32_t data) {
+    response = clockByte(data);
+}
+
+uint32_t readSpi0Data() {
+    return response;
+}
+
+void writeSpi0Block(const uint8_t data[], uint16_t size) {
+    uint16_t i;
+    for (i = 0; i < size; i++) {
+        clockByte(data[i]);
+    }
+}
+
+void readSpi0Block(uint8_t data[], uint16_t size) {
+    uint16_t i;
+    for (i = 0; i < size; i++) {
+        data[i] = clockByte(0);
+    }
+}
+
+/* gpio.c, only ~CS (PA3), RESET (PB2) and INT (PC6) mean anything */
+
+void enablePort(PORT port) {
+    (void)port;
+}
+
+void selectPinPushPullOutput(PORT port, uint8_t pin) {
+    (void)port;
+    (void)pin;
+}
+
+void selectPinDigitalInput(PORT port, uint8_t pin) {
+    (void)port;
+    (void)pin;
+}
+
+void selectPinInterruptFallingEdge(PORT port, uint8_t pin) {
+    (void)port;
+    (void)pin;
+}
+
+void enablePinInterrupt(PORT port, uint8_t pin) {
+    (void)port;
+    (void)pin;
+}
+
+void clearPinInterrupt(PORT port, uint8_t pin) {
+    (void)port;
+    (void)pin;
+}
+
+void setPinValue(PORT port, uint8_t pin, bool value) {
+    if (port == PORTA && pin == 3) {
+        if (!value && !selected) {
+            selected = true;
+            byteIndex = 0;
+        }
+        else if (value && selected) {
+            selected = false;
+            endTransaction();
+        }
+    }
+    else if (port == PORTB && pin == 2 && !value) {
+        resetRegisters();
+    }
+}
+
+bool getPinValue(PORT port, uint8_t pin) {
+    if (port == PORTC && pin == 6) {
+        return !isEnc28j60IntAsserted();
+    }
+    return true;
+}
+
+/* wait.c, clock.c */
+
+void waitMicrosecond(uint32_t us) {
+    encCycles += 40 * us;
+}
+
+uint32_t getCycleCount() {
+    return encCycles;
+}
+
+void _delay_cycles(uint32_t cycles) {
+    encCycles += cycles;
+}
@@ -0,0 +1,84 @@
+/******************************************************************************
+ * File:        enc28j60_model.h
+ *
+ * Author:      Giancarlo Perez
+ *
+ * Created:     10/17/26
+ *
+ * Description: Host model of the ENC28J60 behind SPI0, see enc28j60_model.c
+ ******************************************************************************/
+
+#ifndef ENC28J60_MODEL_H_
+#define ENC28J60_MODEL_H_
+
+//=============================================================================
+// INCLUDES
+//=============================================================================
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//=============================================================================
+// DEFINES AND MACROS
+//=============================================================================
+
+#define ENC_SPI_LOG_SIZE    256     // transactions kept in the log
+#define ENC_TX_LOG_SIZE     16      // transmitted frames kept
+#define ENC_MAX_FRAME       1518
+
+/* Opcodes (first byte of a transaction) */
+#define ENC_OP_RCR  0x00
+#define ENC_OP_RBM  0x3A
+#define ENC_OP_WCR  0x40
+#define ENC_OP_WBM  0x7A
+#define ENC_OP_BFS  0x80
+#define ENC_OP_BFC  0xA0
+#define ENC_OP_SRC  0xFF
+
+//=============================================================================
+// TYPEDEFS AND GLOBALS
+//=============================================================================
+
+// SPI traffic, one entry per chip select (low to high)
+typedef struct _encSpiLog
+{
+    uint32_t transactions;
+    uint32_t bytes;                         // opcodes included
+    uint32_t stray;                         // bytes clocked with CS high
+    uint32_t logged;                        // entries below, stops when full
+    uint16_t size[ENC_SPI_LOG_SIZE];        // bytes clocked in each transaction
+    uint8_t  opcode[ENC_SPI_LOG_SIZE];      // first byte, register bits cleared
+} encSpiLog;
+
+typedef struct _encTxFrame
+{
+    uint16_t start;                         // ETXST (control byte)
+    uint16_t size;
+    bool     aborted;
+    uint8_t  data[ENC_MAX_FRAME];
+} encTxFrame;
+
+extern encSpiLog encSpi;
+extern encTxFrame encTx[ENC_TX_LOG_SIZE];
+extern uint8_t encTxCount;
+extern uint32_t encTxResets;                // TXRST pulses
+extern uint8_t encTxWireReads;              // ECON1 reads a frame stays on the wire
+extern bool encTxAbortNext;                 // abort the next frame (late collision)
+extern bool encLinkUp;
+extern uint32_t encBaudRate;                // from setSpi0BaudRate()
+extern uint32_t encCycles;                  // getCycleCount(), moved by SPI traffic
+
+//=============================================================================
+// FUNCTION PROTOTYPES
+//=============================================================================
+
+void resetEnc28j60Model(void);
+void clearEnc28j60SpiLog(void);
+uint32_t countEnc28j60Transactions(uint8_t opcode);
+bool injectEnc28j60Frame(const uint8_t frame[], uint16_t size);
+uint8_t readEnc28j60Mem(uint16_t add);
+uint8_t readEnc28j60Reg(uint8_t reg);
+uint8_t getEnc28j60PacketCount(void);
+bool isEnc28j60IntAsserted(void);
+
+#endif
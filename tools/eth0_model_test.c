@@ -0,0 +1,453 @@
+/******************************************************************************
+ * File:        eth0_model_test.c
+ *
+ * Author:      Giancarlo Perez
+ *
+ * Created:     10/17/26
+ *
+ * Description: Host test of drivers/eth0.c against the ENC28J60 model in
+ *              enc28j60_model.c. Checks that frames reach buffer memory and
+ *              come back out byte for byte (including reads that wrap
+ *              around the end of the rx buffer), and counts the SPI
+ *              transactions and bytes each call costs: buffer memory moves
+ *              as one burst per frame and the number of transactions does
+ *              not depend on the frame size. In async tx mode frames are
+ *              queued while one is on the wire, go out in order and intact,
+ *              and aborts are recovered from without holding INT low.
+ *              With ETHER_CSUM_OFFLOAD_ENABLED, checksums from the DMA
+ *              engine (tx after staging, rx before copying, ranges that
+ *              wrap in the rx buffer) must equal the software ones byte for
+ *              byte, without it the offload mode must be ignored.
+ *              Exits non-zero on failure.
+ *
+ *              gcc -std=gnu99 -O2 -DETHER_CSUM_OFFLOAD_ENABLED -Itools/host -Iinclude \
+ *                  tools/eth0_model_test.c tools/enc28j60_model.c drivers/eth0.c \
+ *                  -o eth0_model_test
+ *              ./eth0_model_test
+ ******************************************************************************/
+
+//=============================================================================
+// INCLUDES
+//=============================================================================
+
+#include "eth0.h"
+#include "enc28j60_model.h"
+#include <stdio.h>
+#include <string.h>
+
+//=============================================================================
+// DEFINES AND MACROS
+//=============================================================================
+
+#define CHECK(cond) do { if (!(cond)) { printf("  FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); return false; } } while (0)
+
+/* Registers as addressed in eth0.c */
+#define ERXNDL      0x0A
+#define ERXNDH      0x0B
+#define ERXRDPTL    0x0C
+#define ERXRDPTH    0x0D
+#define ERXWRPTL    0x0E
+#define ERXWRPTH    0x0F
+#define EIR         0x1C
+#define TXIF    0x08
+
+#define CYCLES_PER_US 40
+
+#define UDP_OFFSET      (14 + 20)   // ethernet and ip headers
+#define UDP_CHECK       6           // checksum field in the udp header
+
+//=============================================================================
+// TYPEDEFS AND GLOBALS
+//=============================================================================
+
+typedef struct _modelTest
+{
+    const char* name;
+    bool (*run)(void);
+} modelTest;
+
+static uint8_t frame[ENC_MAX_FRAME + 4];
+static uint8_t buffer[ENC_MAX_FRAME + 4];
+
+//=============================================================================
+// STATIC FUNCTIONS
+//=============================================================================
+
+static void fillFrame(uint8_t data[], uint16_t size, uint8_t seed) {
+    uint16_t i;
+    for (i = 0; i < size; i++) {
+        data[i] = (uint8_t)(seed + i * 7 + (i >> 8));
+    }
+}
+
+static uint16_t getModelReg16(uint8_t reg) {
+    return readEnc28j60Reg(reg) | (readEnc28j60Reg(reg + 1) << 8);
+}
+
+static void startModel(uint16_t mode) {
+    resetEnc28j60Model();
+    initEther(mode);
+    clearEnc28j60SpiLog();
+}
+
+static bool testInit(void) {
+    startModel(ETHER_UNICAST | ETHER_BROADCAST | ETHER_HALFDUPLEX);
+    CHECK(encBaudRate == 20000000);
+    CHECK(getModelReg16(ERXNDL) == 0x2000 - 0x05F6 - 1);
+    CHECK(isEtherLinkUp());
+    encLinkUp = false;
+    CHECK(!isEtherLinkUp());
+    return true;
+}
+
+// Sends frames of each size, checks they went out intact and that the
+// controller saw one memory write burst per frame and a fixed number of
+// transactions around it
+static bool testPutTransactions(void) {
+    static const uint16_t sizes[] = {60, 590, 1514};
+    uint32_t transactions = 0, overhead = 0, cycles;
+    uint8_t i;
+    startModel(ETHER_UNICAST | ETHER_BROADCAST | ETHER_HALFDUPLEX);
+    printf("  %-6s %12s %8s %9s\n", "put", "transactions", "bytes", "bus us");
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        fillFrame(frame, sizes[i], i);
+        clearEnc28j60SpiLog();
+        cycles = encCycles;
+        CHECK(putEtherPacket((etherHeader*)frame, sizes[i]));
+        cycles = encCycles - cycles;
+        printf("  %-6u %12u %8u %9.1f\n", sizes[i], encSpi.transactions, encSpi.bytes,
+               (double)cycles / CYCLES_PER_US);
+        CHECK(encTxCount == i + 1);
+        CHECK(encTx[i].size == sizes[i]);
+        CHECK(memcmp(encTx[i].data, frame, sizes[i]) == 0);
+        CHECK(countEnc28j60Transactions(ENC_OP_WBM) == 1);
+        CHECK(encSpi.logged == encSpi.transactions);
+        if (i == 0) {
+            transactions = encSpi.transactions;
+            overhead = encSpi.bytes - sizes[i];
+        }
+        CHECK(encSpi.transactions == transactions);
+        CHECK(encSpi.bytes - sizes[i] == overhead);
+        CHECK(encSpi.stray == 0);
+    }
+    // opcode and control byte ride in the same burst as the frame
+    for (i = 0; i < encSpi.logged; i++) {
+        if (encSpi.opcode[i] == ENC_OP_WBM) {
+            CHECK(encSpi.size[i] == 2 + sizes[2]);
+        }
+    }
+    return true;
+}
+
+// Receives frames of each size with getEtherPacket(), checks the contents
+// (frame then crc) and that the frame came over in one memory read burst
+static bool testGetTransactions(void) {
+    static const uint16_t sizes[] = {60, 590, 1514};
+    uint32_t transactions = 0;
+    uint16_t size;
+    uint8_t i;
+    startModel(ETHER_UNICAST | ETHER_BROADCAST | ETHER_HALFDUPLEX);
+    printf("  %-6s %12s %8s %9s\n", "get", "transactions", "bytes", "bus us");
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        fillFrame(frame, sizes[i], 0x40 + i);
+        CHECK(injectEnc28j60Frame(frame, sizes[i]));
+        clearEnc28j60SpiLog();
+        uint32_t cycles = encCycles;
+        size = getEtherPacket((etherHeader*)buffer, sizeof(buffer));
+        cycles = encCycles - cycles;
+        printf("  %-6u %12u %8u %9.1f\n", sizes[i], encSpi.transactions, encSpi.bytes,
+               (double)cycles / CYCLES_PER_US);
+        CHECK(size == sizes[i] + 4);
+        CHECK(memcmp(buffer, frame, sizes[i]) == 0);
+        CHECK(countEnc28j60Transactions(ENC_OP_RBM) == 1);
+        if (i == 0) {
+            transactions = encSpi.transactions;
+        }
+        CHECK(encSpi.transactions == transactions);
+        CHECK(getEnc28j60PacketCount() == 0);
+        CHECK(encSpi.stray == 0);
+    }
+    for (i = 0; i < encSpi.logged; i++) {
+        if (encSpi.opcode[i] == ENC_OP_RBM) {
+            CHECK(encSpi.size[i] == 1 + 6 + sizes[2] + 4);
+        }
+    }
+    return true;
+}
+
+// Peeks at the head of a frame, then reads the rest in a second burst
+static bool testPeekFinish(void) {
+    uint16_t size;
+    uint8_t i, bursts = 0;
+    startModel(ETHER_UNICAST | ETHER_BROADCAST | ETHER_HALFDUPLEX);
+    fillFrame(frame, 1000, 0x11);
+    CHECK(injectEnc28j60Frame(frame, 1000));
+    clearEnc28j60SpiLog();
+    CHECK(peekEtherPacket((etherHeader*)buffer, 64) == 1004);
+    CHECK(memcmp(buffer, frame, 64) == 0);
+    memset(buffer + 64, 0, sizeof(buffer) - 64);
+    size = finishEtherPacket((etherHeader*)buffer, sizeof(buffer));
+    CHECK(size == 1004);
+    CHECK(memcmp(buffer, frame, 1000) == 0);
+    for (i = 0; i < encSpi.logged; i++) {
+        if (encSpi.opcode[i] == ENC_OP_RBM) {
+            CHECK(encSpi.size[i] == (bursts == 0 ? 1 + 6 + 64 : 1 + 1004 - 64));
+            bursts++;
+        }
+    }
+    CHECK(bursts == 2);
+
+    // a discarded frame costs no memory reads past the peek
+    fillFrame(frame, 1000, 0x22);
+    CHECK(injectEnc28j60Frame(frame, 1000));
+    clearEnc28j60SpiLog();
+    CHECK(peekEtherPacket((etherHeader*)buffer, 64) == 1004);
+    discardEtherPacket();
+    CHECK(countEnc28j60Transactions(ENC_OP_RBM) == 1);
+    CHECK(getEnc28j60PacketCount() == 0);
+    CHECK((getModelReg16(ERXRDPTL) & 1) == 1);
+    return true;
+}
+
+// Runs enough frames through a small rx buffer (four tx slots) that some of
+// them wrap around its end, and checks each one
+static bool testRxWrap(void) {
+    uint16_t wr, size, i, wraps = 0;
+    startModel(ETHER_UNICAST | ETHER_BROADCAST | ETHER_HALFDUPLEX | ETHER_TX_SLOTS(4));
+    for (i = 0; i < 40; i++) {
+        size = 200 + (i * 97) % 1300;
+        fillFrame(frame, size, i);
+        wr = getModelReg16(ERXWRPTL);
+        CHECK(injectEnc28j60Frame(frame, size));
+        if (getModelReg16(ERXWRPTL) < wr) {
+            wraps++;
+        }
+        CHECK(isEtherRxPending());
+        CHECK(getEtherPacketCount() == 1);
+        memset(buffer, 0, sizeof(buffer));
+        CHECK(getEtherPacket((etherHeader*)buffer, sizeof(buffer)) == size + 4);
+        CHECK(memcmp(buffer, frame, size) == 0);
+    }
+    CHECK(wraps > 2);
+    CHECK(!isEtherRxPending());
+    return true;
+}
+
+// Queues frames in async tx mode while the first one is on the wire
+// The third put reuses the first slot, so it has to wait for that frame to
+// leave, and must not change it before then
+static bool testAsyncQueue(void) {
+    static uint8_t frames[3][600];
+    uint8_t i;
+    startModel(ETHER_UNICAST | ETHER_BROADCAST | ETHER_HALFDUPLEX | ETHER_ASYNC_TX);
+    encTxWireReads = 20;
+    for (i = 0; i < 3; i++) {
+        fillFrame(frames[i], sizeof(frames[i]), 0x80 + i);
+        CHECK(putEtherPacket((etherHeader*)frames[i], sizeof(frames[i])));
+        CHECK(isEtherTxBusy());
+        if (i < 2) {
+            CHECK(encTxCount == 0);    // returned while the first frame is on the wire
+        }
+    }
+    CHECK(encTxCount == 1);
+    while (isEtherTxBusy()) {
+        pollEtherTx();
+    }
+    CHECK(encTxCount == 3);
+    for (i = 0; i < 3; i++) {
+        CHECK(!encTx[i].aborted);
+        CHECK(encTx[i].size == sizeof(frames[i]));
+        CHECK(memcmp(encTx[i].data, frames[i], sizeof(frames[i])) == 0);
+    }
+    CHECK(encTx[0].start == encTx[2].start);
+    CHECK(encTx[0].start != encTx[1].start);
+    return true;
+}
+
+// An aborted frame is reported in blocking mode, the transmit logic is reset
+// and the next frame goes out, in async mode the queue keeps draining
+static bool testTxAbort(void) {
+    fillFrame(frame, 300, 0x33);
+    startModel(ETHER_UNICAST | ETHER_BROADCAST | ETHER_HALFDUPLEX);
+    encTxAbortNext = true;
+    CHECK(!putEtherPacket((etherHeader*)frame, 300));
+    CHECK(encTxResets == 1);
+    CHECK(putEtherPacket((etherHeader*)frame, 300));
+    CHECK(encTxCount == 2 && encTx[0].aborted && !encTx[1].aborted);
+
+    startModel(ETHER_UNICAST | ETHER_BROADCAST | ETHER_HALFDUPLEX | ETHER_ASYNC_TX);
+    encTxWireReads = 3;
+    encTxAbortNext = true;
+    CHECK(putEtherPacket((etherHeader*)frame, 300));
+    CHECK(putEtherPacket((etherHeader*)frame, 300));
+    while (isEtherTxBusy()) {
+        pollEtherTx();
+    }
+    CHECK(encTxCount == 2 && encTx[0].aborted && !encTx[1].aborted);
+    CHECK(encTxResets == 1);
+    return true;
+}
+
+// TXIF stays set after a frame goes out, with tx interrupts masked it must
+// not hold INT low and look like a receive event
+static bool testTxLeavesIntHigh(void) {
+    startModel(ETHER_UNICAST | ETHER_BROADCAST | ETHER_HALFDUPLEX | ETHER_ASYNC_TX);
+    fillFrame(frame, 100, 0x44);
+    CHECK(putEtherPacket((etherHeader*)frame, 100));
+    while (isEtherTxBusy()) {
+        pollEtherTx();
+    }
+    CHECK((readEnc28j60Reg(EIR) & TXIF) != 0);
+    CHECK(!isEnc28j60IntAsserted());
+    CHECK(!isEtherRxPending());
+    CHECK(injectEnc28j60Frame(frame, 100));
+    CHECK(isEnc28j60IntAsserted());
+    CHECK(isEtherRxPending());
+    return true;
+}
+
+// Software checksum as in ip.c: memory order 16-bit words, odd last byte
+// in the low half, complemented, so the result can be stored as is
+static uint32_t sumWords(const uint8_t data[], uint16_t size, uint32_t sum) {
+    uint16_t i;
+    for (i = 0; i + 1 < size; i += 2) {
+        sum += data[i] | (data[i + 1] << 8);
+    }
+    if (size & 1) {
+        sum += data[size - 1];
+    }
+    return sum;
+}
+
+// Builds an ethernet/ip/udp frame with dataSize bytes of payload, checksum
+// field zero, and returns the pseudo-header sum
+static uint32_t buildUdpFrame(uint8_t data[], uint16_t dataSize, uint8_t seed) {
+    uint16_t udpLength = 8 + dataSize;
+    uint8_t pseudo[4];
+    uint32_t sum;
+    fillFrame(data, UDP_OFFSET + udpLength, seed);
+    data[12] = 0x08;
+    data[13] = 0x00;
+    data[14] = 0x45;
+    data[14 + 9] = 17;
+    data[UDP_OFFSET + 4] = udpLength >> 8;
+    data[UDP_OFFSET + 5] = udpLength & 0xFF;
+    data[UDP_OFFSET + UDP_CHECK] = 0;
+    data[UDP_OFFSET + UDP_CHECK + 1] = 0;
+    sum = sumWords(data + 14 + 12, 8, 0);   // source and destination ip
+    pseudo[0] = 0;
+    pseudo[1] = 17;
+    pseudo[2] = udpLength >> 8;
+    pseudo[3] = udpLength & 0xFF;
+    return sumWords(pseudo, 4, sum);
+}
+
+#ifdef ETHER_CSUM_OFFLOAD_ENABLED
+
+static uint16_t getChecksum(uint32_t sum) {
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return ~sum;
+}
+
+// Lets the controller fill in udp checksums (seeded with the pseudo-header
+// sum as udp.c does) and compares each frame on the wire with the one
+// checksummed in software
+static bool testChecksumTx(void) {
+    static const uint16_t sizes[] = {0, 1, 18, 19, 1024, 1471, 1472};
+    uint32_t pseudo;
+    uint16_t check, seed;
+    uint8_t i;
+    startModel(ETHER_UNICAST | ETHER_BROADCAST | ETHER_HALFDUPLEX | ETHER_CSUM_OFFLOAD);
+    CHECK(isEtherChecksumOffload());
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        pseudo = buildUdpFrame(frame, sizes[i], 0x50 + i);
+        check = getChecksum(sumWords(frame + UDP_OFFSET, 8 + sizes[i], pseudo));
+        seed = ~getChecksum(pseudo);
+        memcpy(frame + UDP_OFFSET + UDP_CHECK, &seed, 2);
+        CHECK(putEtherPacketWithChecksum((etherHeader*)frame, UDP_OFFSET + 8 + sizes[i], UDP_OFFSET, UDP_OFFSET + UDP_CHECK));
+        CHECK(encTxCount == i + 1);
+        memcpy(frame + UDP_OFFSET + UDP_CHECK, &check, 2);
+        CHECK(memcmp(encTx[i].data, frame, UDP_OFFSET + 8 + sizes[i]) == 0);
+        CHECK(getChecksum(sumWords(encTx[i].data + UDP_OFFSET, 8 + sizes[i], pseudo)) == 0);
+    }
+    return true;
+}
+
+// Has the controller sum the payload of received frames before they are
+// copied and compares with the software sum of the copy, some frames wrap
+// around the end of the rx buffer
+static bool testChecksumRx(void) {
+    uint16_t size, csum, i, wraps = 0, wr;
+    startModel(ETHER_UNICAST | ETHER_BROADCAST | ETHER_HALFDUPLEX | ETHER_CSUM_OFFLOAD | ETHER_TX_SLOTS(4));
+    for (i = 0; i < 40; i++) {
+        size = UDP_OFFSET + 8 + (i * 131) % 1400 + (i & 1);
+        buildUdpFrame(frame, size - UDP_OFFSET - 8, i);
+        wr = getModelReg16(ERXWRPTL);
+        CHECK(injectEnc28j60Frame(frame, size));
+        if (getModelReg16(ERXWRPTL) < wr) {
+            wraps++;
+        }
+        CHECK(peekEtherPacket((etherHeader*)buffer, 64) == size + 4);
+        CHECK(!getEtherRxChecksum(UDP_OFFSET, size + 5 - UDP_OFFSET, &csum));   // past the crc
+        CHECK(getEtherRxChecksum(UDP_OFFSET, size - UDP_OFFSET, &csum));
+        CHECK(finishEtherPacket((etherHeader*)buffer, sizeof(buffer)) == size + 4);
+        CHECK(memcmp(buffer, frame, size) == 0);
+        CHECK(csum == getChecksum(sumWords(buffer + UDP_OFFSET, size - UDP_OFFSET, 0)));
+    }
+    CHECK(wraps > 2);
+    return true;
+}
+
+#else
+
+// Without ETHER_CSUM_OFFLOAD_ENABLED the mode is ignored and frames go out
+// as written
+static bool testChecksumOff(void) {
+    uint16_t csum;
+    startModel(ETHER_UNICAST | ETHER_BROADCAST | ETHER_HALFDUPLEX | ETHER_CSUM_OFFLOAD);
+    CHECK(!isEtherChecksumOffload());
+    buildUdpFrame(frame, 100, 0x66);
+    CHECK(putEtherPacketWithChecksum((etherHeader*)frame, UDP_OFFSET + 108, UDP_OFFSET, UDP_OFFSET + UDP_CHECK));
+    CHECK(memcmp(encTx[0].data, frame, UDP_OFFSET + 108) == 0);
+    CHECK(injectEnc28j60Frame(frame, UDP_OFFSET + 108));
+    CHECK(peekEtherPacket((etherHeader*)buffer, 64) != 0);
+    CHECK(!getEtherRxChecksum(UDP_OFFSET, 108, &csum));
+    discardEtherPacket();
+    return true;
+}
+
+#endif
+
+//=============================================================================
+// PUBLIC FUNCTIONS
+//=============================================================================
+
+int main(void) {
+    static const modelTest tests[] = {
+        {"init",            testInit},
+        {"put bursts",      testPutTransactions},
+        {"get bursts",      testGetTransactions},
+        {"peek and finish", testPeekFinish},
+        {"rx wrap",         testRxWrap},
+        {"async tx queue",  testAsyncQueue},
+        {"tx abort",        testTxAbort},
+        {"tx leaves INT",   testTxLeavesIntHigh},
+#ifdef ETHER_CSUM_OFFLOAD_ENABLED
+        {"tx checksum",     testChecksumTx},
+        {"rx checksum",     testChecksumRx},
+#else
+        {"checksum off",    testChecksumOff},
+#endif
+    };
+    uint8_t i, failed = 0;
+    for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        printf("%s\n", tests[i].name);
+        if (!tests[i].run()) {
+            failed++;
+        }
+    }
+    printf("%u of %u failed\n", failed, (unsigned)(sizeof(tests) / sizeof(tests[0])));
+    return failed != 0;
+}
@@ -0,0 +1,40 @@
+/******************************************************************************
+ * File:        tm4c123gh6pm.h (host)
+ *
+ * Author:      Giancarlo Perez
+ *
+ * Created:     10/17/26
+ *
+ * Description: Stand-in for the device header when a driver is built on the
+ *              host against a model of its peripheral (see
+ *              tools/enc28j60_model.c). Put tools/host ahead of include on
+ *              the include path. Only what those drivers touch directly is
+ *              here, as plain variables instead of register addresses.
+ ******************************************************************************/
+
+#ifndef TM4C123GH6PM_H_
+#define TM4C123GH6PM_H_
+
+#include <stdint.h>
+
+//=============================================================================
+// DEFINES AND MACROS
+//=============================================================================
+
+#define INT_GPIOC               18          // GPIO Port C
+
+#define NVIC_EN0_R              hostNvicEn0
+
+//=============================================================================
+// TYPEDEFS AND GLOBALS
+//=============================================================================
+
+extern volatile uint32_t hostNvicEn0;
+
+//=============================================================================
+// FUNCTION PROTOTYPES
+//=============================================================================
+
+void _delay_cycles(uint32_t cycles);    // compiler intrinsic on the target
+
+#endif
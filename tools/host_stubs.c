@@ -0,0 +1,90 @@
+/******************************************************************************
+ * File:        host_stubs.c
+ *
+ * Author:      Giancarlo Perez
+ *
+ * Created:     10/17/26
+ *
+ * Description: Board functions the stack calls, for host tools that link the
+ *              middleware, libs and network_stack.c without the TM4C drivers.
+ *              Time comes from the timer virtual clock (build everything with
+ *              -DTIMER_VIRTUAL_CLOCK), the UART goes to stdout only when
+ *              hostUartEcho is set, the EEPROM reads as erased and the LEDs
+ *              and the scheduler are no-ops since the tool runs the tasks
+ ******************************************************************************/
+
+//=============================================================================
+// INCLUDES
+//=============================================================================
+
+#include "eth0.h"
+#include "clock.h"
+#include "uart0.h"
+#include "eeprom.h"
+#include "gpio.h"
+#include "scheduler.h"
+#include <stdio.h>
+#include <string.h>
+
+//=============================================================================
+// TYPEDEFS AND GLOBALS
+//=============================================================================
+
+const uint8_t EMPTY_MAC_ADDRESS[HW_ADD_LENGTH] = {0, 0, 0, 0, 0, 0};
+const uint8_t BROADCAST_MAC_ADDRESS[HW_ADD_LENGTH] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+volatile uint32_t systime = 0;     // moved by advanceTimerClock()
+bool hostUartEcho = false;
+
+//=============================================================================
+// PUBLIC FUNCTIONS
+//=============================================================================
+
+/* clock.c */
+
+uint32_t millis() {
+    return systime;
+}
+
+/* eth0.c (the parts the stack uses without going through netif) */
+
+void copyMacAddress(uint8_t dest[6], const uint8_t src[6]) {
+    memcpy(dest, src, HW_ADD_LENGTH);
+}
+
+void getEtherStats(etherStats* s) {
+    memset(s, 0, sizeof(etherStats));
+}
+
+/* uart0.c */
+
+void putsUart0(char* str) {
+    if (hostUartEcho) {
+        fputs(str, stdout);
+    }
+}
+
+/* eeprom.c */
+
+uint32_t readEeprom(uint16_t add) {
+    (void)add;
+    return 0xFFFFFFFF;
+}
+
+void writeEeprom(uint16_t add, uint32_t data) {
+    (void)add;
+    (void)data;
+}
+
+/* gpio.c */
+
+void setPinValue(PORT port, uint8_t pin, bool value) {
+    (void)port;
+    (void)pin;
+    (void)value;
+}
+
+/* scheduler.c */
+
+void requestSchedulerPass() {
+}
@@ -0,0 +1,389 @@
+/******************************************************************************
+ * File:        netif_bench.c
+ *
+ * Author:      Giancarlo Perez
+ *
+ * Created:     10/17/26
+ *
+ * Description: Host benchmark and regression test for the stack on a queue
+ *              interface. The stack (middleware, libs and network_stack.c)
+ *              runs on "host0" and this tool plays a peer on the other end
+ *              of the queue pair. The peer sends ARP requests, pings, UDP
+ *              datagrams and SYNs to a closed port, and checks every reply
+ *              (type, addresses, checksums, echoed data). For each kind it
+ *              prints the round trip through runNetworkRx()/runNetworkTx()
+ *              one frame at a time, and the frame rate with the receive
+ *              queue kept full. Exits non-zero if any reply is missing or
+ *              wrong.
+ *
+ *              gcc -std=gnu99 -O2 -fgnu89-inline -fcommon -DTIMER_VIRTUAL_CLOCK \
+ *                  -DNETIF_QUEUE_SIZE=8 -Iinclude tools/netif_bench.c \
+ *                  tools/host_stubs.c middleware/[a-z]*.c libs/timer.c libs/trace.c \
+ *                  libs/profiler.c libs/strlib.c libs/mqtt_client.c \
+ *                  src/network_stack.c -o netif_bench
+ *              ./netif_bench [frames]
+ ******************************************************************************/
+
+#define _POSIX_C_SOURCE 199309L
+
+//=============================================================================
+// INCLUDES
+//=============================================================================
+
+#include "netif.h"
+#include "ip.h"
+#include "arp.h"
+#include "icmp.h"
+#include "udp.h"
+#include "tcp.h"
+#include "socket.h"
+#include "dhcp.h"
+#include "timer.h"
+#include "network_stack.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//=============================================================================
+// DEFINES AND MACROS
+//=============================================================================
+
+#define DEFAULT_FRAMES 200000
+
+#define BENCH_UDP_PORT   7
+#define BENCH_TCP_PORT   9      // nothing listens, so every SYN gets a RST
+
+//=============================================================================
+// TYPEDEFS AND GLOBALS
+//=============================================================================
+
+typedef struct _benchCase {
+    const char* name;
+    uint16_t (*build)(uint8_t frame[], uint16_t seq, uint16_t size);
+    bool (*check)(const uint8_t request[], const uint8_t reply[], uint16_t replySize);
+    uint16_t size;      // payload bytes
+} benchCase;
+
+static const uint8_t stackMac[HW_ADD_LENGTH] = {0x02, 0x03, 0x04, 0x05, 0x06, 0xF6};
+static const uint8_t peerMac[HW_ADD_LENGTH] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+static const uint8_t stackIp[IP_ADD_LENGTH] = {192, 168, 1, 2};
+static const uint8_t peerIp[IP_ADD_LENGTH] = {192, 168, 1, 10};
+static const uint8_t gatewayIp[IP_ADD_LENGTH] = {192, 168, 1, 1};
+static const uint8_t subnetMask[IP_ADD_LENGTH] = {255, 255, 255, 0};
+
+static netif stackIf, peerIf;
+static netifQueue stackQueue, peerQueue;
+
+static uint8_t requests[NETIF_QUEUE_SIZE][MAX_PACKET_SIZE];
+static uint8_t reply[MAX_PACKET_SIZE];
+
+//=============================================================================
+// FRAME BUILDERS (peer side)
+//=============================================================================
+
+static ipHeader* buildIpFrame(uint8_t frame[], uint8_t protocol, uint16_t l4Size, uint16_t seq) {
+    etherHeader* ether = (etherHeader*)frame;
+    ipHeader* ip = (ipHeader*)ether->data;
+    memcpy(ether->destAddress, stackMac, HW_ADD_LENGTH);
+    memcpy(ether->sourceAddress, peerMac, HW_ADD_LENGTH);
+    ether->frameType = htons(TYPE_IP);
+    memset(ip, 0, sizeof(ipHeader));
+    ip->rev = 4;
+    ip->size = 5;
+    ip->length = htons(sizeof(ipHeader) + l4Size);
+    ip->id = htons(seq);
+    ip->ttl = 64;
+    ip->protocol = protocol;
+    memcpy(ip->sourceIp, peerIp, IP_ADD_LENGTH);
+    memcpy(ip->destIp, stackIp, IP_ADD_LENGTH);
+    calcIpChecksum(ip);
+    return ip;
+}
+
+static uint16_t getL4Checksum(ipHeader* ip, void* l4, uint16_t l4Size) {
+    uint32_t sum = 0;
+    sumIpPseudoHeader(ip, l4Size, &sum);
+    sumIpWords(l4, l4Size, &sum);
+    return getIpChecksum(sum);
+}
+
+static void fillPayload(uint8_t data[], uint16_t size, uint16_t seq) {
+    uint16_t i;
+    for (i = 0; i < size; i++) {
+        data[i] = (uint8_t)(seq + i * 7);
+    }
+}
+
+static uint16_t buildArpRequest(uint8_t frame[], uint16_t seq, uint16_t size) {
+    etherHeader* ether = (etherHeader*)frame;
+    arpPacket* arp = (arpPacket*)ether->data;
+    (void)seq;
+    (void)size;
+    memset(ether->destAddress, 0xFF, HW_ADD_LENGTH);
+    memcpy(ether->sourceAddress, peerMac, HW_ADD_LENGTH);
+    ether->frameType = htons(TYPE_ARP);
+    arp->hardwareType = htons(1);
+    arp->protocolType = htons(TYPE_IP);
+    arp->hardwareSize = HW_ADD_LENGTH;
+    arp->protocolSize = IP_ADD_LENGTH;
+    arp->op = htons(1);
+    memcpy(arp->sourceAddress, peerMac, HW_ADD_LENGTH);
+    memcpy(arp->sourceIp, peerIp, IP_ADD_LENGTH);
+    memset(arp->destAddress, 0, HW_ADD_LENGTH);
+    memcpy(arp->destIp, stackIp, IP_ADD_LENGTH);
+    return sizeof(etherHeader) + sizeof(arpPacket);
+}
+
+static uint16_t buildPing(uint8_t frame[], uint16_t seq, uint16_t size) {
+    ipHeader* ip = buildIpFrame(frame, PROTOCOL_ICMP, sizeof(icmpHeader) + size, seq);
+    icmpHeader* icmp = (icmpHeader*)ip->data;
+    uint32_t sum = 0;
+    icmp->type = 8;
+    icmp->code = 0;
+    icmp->check = 0;
+    icmp->id = htons(0x4242);
+    icmp->seq_no = htons(seq);
+    fillPayload(icmp->data, size, seq);
+    sumIpWords(icmp, sizeof(icmpHeader) + size, &sum);
+    icmp->check = getIpChecksum(sum);
+    return sizeof(etherHeader) + sizeof(ipHeader) + sizeof(icmpHeader) + size;
+}
+
+static uint16_t buildUdp(uint8_t frame[], uint16_t seq, uint16_t size) {
+    ipHeader* ip = buildIpFrame(frame, PROTOCOL_UDP, sizeof(udpHeader) + size, seq);
+    udpHeader* udp = (udpHeader*)ip->data;
+    udp->sourcePort = htons(50000 + (seq & 0xFF));
+    udp->destPort = htons(BENCH_UDP_PORT);
+    udp->length = htons(sizeof(udpHeader) + size);
+    udp->check = 0;
+    fillPayload(udp->data, size, seq);
+    udp->data[0] = 'x';     // not "on" or "off"
+    udp->check = getL4Checksum(ip, udp, sizeof(udpHeader) + size);
+    return sizeof(etherHeader) + sizeof(ipHeader) + sizeof(udpHeader) + size;
+}
+
+static uint16_t buildSyn(uint8_t frame[], uint16_t seq, uint16_t size) {
+    ipHeader* ip = buildIpFrame(frame, PROTOCOL_TCP, sizeof(tcpHeader), seq);
+    tcpHeader* tcp = (tcpHeader*)ip->data;
+    (void)size;
+    memset(tcp, 0, sizeof(tcpHeader));
+    tcp->sourcePort = htons(40000 + (seq & 0xFF));
+    tcp->destPort = htons(BENCH_TCP_PORT);
+    tcp->sequenceNumber = htonl(1000u * seq);
+    tcp->offsetFields = htons((5 << 12) | SYN);
+    tcp->windowSize = htons(1024);
+    tcp->checksum = getL4Checksum(ip, tcp, sizeof(tcpHeader));
+    return sizeof(etherHeader) + sizeof(ipHeader) + sizeof(tcpHeader);
+}
+
+//=============================================================================
+// REPLY CHECKS
+//=============================================================================
+
+// Ethernet and IP fields every IP reply must have
+static ipHeader* checkIpReply(const uint8_t reply[], uint16_t replySize, uint8_t protocol) {
+    etherHeader* ether = (etherHeader*)reply;
+    ipHeader* ip = (ipHeader*)ether->data;
+    uint32_t sum = 0;
+    if (replySize < sizeof(etherHeader) + sizeof(ipHeader) || ether->frameType != htons(TYPE_IP)
+            || memcmp(ether->destAddress, peerMac, HW_ADD_LENGTH) != 0
+            || memcmp(ether->sourceAddress, stackMac, HW_ADD_LENGTH) != 0
+            || ip->protocol != protocol || memcmp(ip->sourceIp, stackIp, IP_ADD_LENGTH) != 0
+            || memcmp(ip->destIp, peerIp, IP_ADD_LENGTH) != 0
+            || sizeof(etherHeader) + ntohs(ip->length) > replySize) {
+        return NULL;
+    }
+    sumIpWords(ip, ip->size * 4, &sum);
+    return (getIpChecksum(sum) == 0) ? ip : NULL;
+}
+
+static bool checkArpReply(const uint8_t request[], const uint8_t reply[], uint16_t replySize) {
+    etherHeader* ether = (etherHeader*)reply;
+    arpPacket* arp = (arpPacket*)ether->data;
+    (void)request;
+    return replySize >= sizeof(etherHeader) + sizeof(arpPacket) && ether->frameType == htons(TYPE_ARP)
+            && arp->op == htons(2) && memcmp(ether->destAddress, peerMac, HW_ADD_LENGTH) == 0
+            && memcmp(arp->sourceAddress, stackMac, HW_ADD_LENGTH) == 0
+            && memcmp(arp->sourceIp, stackIp, IP_ADD_LENGTH) == 0
+            && memcmp(arp->destIp, peerIp, IP_ADD_LENGTH) == 0;
+}
+
+static bool checkPingReply(const uint8_t request[], const uint8_t reply[], uint16_t replySize) {
+    ipHeader* req = (ipHeader*)((etherHeader*)request)->data;
+    ipHeader* ip = checkIpReply(reply, replySize, PROTOCOL_ICMP);
+    icmpHeader* icmp;
+    uint16_t size;
+    uint32_t sum = 0;
+    if (ip == NULL || ip->length != req->length) {
+        return false;
+    }
+    icmp = (icmpHeader*)ip->data;
+    size = ntohs(ip->length) - sizeof(ipHeader);
+    sumIpWords(icmp, size, &sum);
+    return icmp->type == 0 && getIpChecksum(sum) == 0
+            && memcmp(&icmp->id, &((icmpHeader*)req->data)->id, size - 4) == 0;
+}
+
+static bool checkUdpReply(const uint8_t request[], const uint8_t reply[], uint16_t replySize) {
+    udpHeader* req = (udpHeader*)((ipHeader*)((etherHeader*)request)->data)->data;
+    ipHeader* ip = checkIpReply(reply, replySize, PROTOCOL_UDP);
+    udpHeader* udp;
+    if (ip == NULL) {
+        return false;
+    }
+    udp = (udpHeader*)ip->data;
+    return udp->sourcePort == req->destPort && udp->destPort == req->sourcePort
+            && ntohs(udp->length) == sizeof(udpHeader) + 9 && memcmp(udp->data, "Received", 9) == 0
+            && (udp->check == 0 || getL4Checksum(ip, udp, ntohs(udp->length)) == 0);
+}
+
+static bool checkRst(const uint8_t request[], const uint8_t reply[], uint16_t replySize) {
+    tcpHeader* req = (tcpHeader*)((ipHeader*)((etherHeader*)request)->data)->data;
+    ipHeader* ip = checkIpReply(reply, replySize, PROTOCOL_TCP);
+    tcpHeader* tcp;
+    uint16_t tcpLength;
+    if (ip == NULL) {
+        return false;
+    }
+    tcp = (tcpHeader*)ip->data;
+    tcpLength = ntohs(ip->length) - ip->size * 4;
+    return (ntohs(tcp->offsetFields) & (RST | ACK)) == (RST | ACK)
+            && tcp->sourcePort == req->destPort && tcp->destPort == req->sourcePort
+            && getL4Checksum(ip, tcp, tcpLength) == 0;
+}
+
+//=============================================================================
+// STACK SETUP
+//=============================================================================
+
+static void initStack(void) {
+    initQueueNetif(&stackIf, "host0", &stackQueue, stackMac);
+    initQueueNetif(&peerIf, "peer", &peerQueue, peerMac);
+    connectQueueNetifs(&stackIf, &peerIf);
+    setNetif(&stackIf);
+    initTimer();
+    initSockets();
+    initArp();
+    disableDhcp();
+    setIpAddress(stackIp);
+    setIpSubnetMask(subnetMask);
+    setIpGatewayAddress(gatewayIp);
+    // first pass sends the gratuitous ARP for the new address
+    runNetworkTx();
+    while (peerIf.ops->isRxPending(&peerIf)) {
+        peerIf.ops->discard(&peerIf);
+    }
+}
+
+// One main loop pass over the network tasks
+static void runStack(void) {
+    runNetworkRx();
+    runNetworkTx();
+}
+
+// Takes the next frame the stack sent, 0 if there is none
+static uint16_t takeReply(void) {
+    uint16_t size = peerIf.ops->peek(&peerIf, (etherHeader*)reply, 0);
+    if (size == 0) {
+        return 0;
+    }
+    return peerIf.ops->finish(&peerIf, (etherHeader*)reply, MAX_PACKET_SIZE);
+}
+
+//=============================================================================
+// TIMING
+//=============================================================================
+
+static double nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Sends one frame at a time and waits for its reply
+static bool runLatency(const benchCase* c, uint32_t frames, double* ns) {
+    uint32_t i;
+    uint16_t size, replySize;
+    double total = 0, start;
+    for (i = 0; i < frames; i++) {
+        size = c->build(requests[0], (uint16_t)i, c->size);
+        start = nowNs();
+        peerIf.ops->tx(&peerIf, (etherHeader*)requests[0], size);
+        runStack();
+        replySize = takeReply();
+        total += nowNs() - start;
+        if (replySize == 0 || !c->check(requests[0], reply, replySize)) {
+            printf("%s: frame %u: %s reply\n", c->name, i, replySize ? "bad" : "no");
+            return false;
+        }
+    }
+    *ns = total / frames;
+    return true;
+}
+
+// Keeps the stack's receive queue full and counts replies
+static bool runThroughput(const benchCase* c, uint32_t frames, double* fps) {
+    uint32_t sent = 0, replies = 0;
+    uint16_t sizes[NETIF_QUEUE_SIZE];
+    uint16_t replySize;
+    uint8_t i, burst;
+    double start = nowNs();
+    while (sent < frames) {
+        burst = (frames - sent < NETIF_QUEUE_SIZE) ? frames - sent : NETIF_QUEUE_SIZE;
+        for (i = 0; i < burst; i++) {
+            sizes[i] = c->build(requests[i], (uint16_t)(sent + i), c->size);
+            peerIf.ops->tx(&peerIf, (etherHeader*)requests[i], sizes[i]);
+        }
+        while (isNetifRxPending()) {
+            runStack();
+        }
+        for (i = 0; (replySize = takeReply()) != 0; i++) {
+            if (i >= burst || !c->check(requests[i], reply, replySize)) {
+                printf("%s: frame %u: bad reply in burst\n", c->name, sent + i);
+                return false;
+            }
+            replies++;
+        }
+        sent += burst;
+    }
+    if (replies != frames) {
+        printf("%s: %u replies to %u frames\n", c->name, replies, frames);
+        return false;
+    }
+    *fps = frames / ((nowNs() - start) / 1e9);
+    return true;
+}
+
+//=============================================================================
+// MAIN
+//=============================================================================
+
+int main(int argc, char* argv[]) {
+    static const benchCase cases[] = {
+        {"arp request",  buildArpRequest, checkArpReply,  0},
+        {"ping 56",      buildPing,       checkPingReply, 56},
+        {"ping 1024",    buildPing,       checkPingReply, 1024},
+        {"udp 18",       buildUdp,        checkUdpReply,  18},
+        {"udp 1024",     buildUdp,        checkUdpReply,  1024},
+        {"syn -> rst",   buildSyn,        checkRst,       0},
+    };
+    uint32_t frames = (argc > 1) ? strtoul(argv[1], NULL, 0) : DEFAULT_FRAMES;
+    double ns, fps;
+    uint8_t i;
+
+    initStack();
+    printf("%u frames per case, receive queue of %u\n\n", frames, NETIF_QUEUE_SIZE);
+    printf("%-12s %12s %14s\n", "case", "ns/round trip", "frames/s");
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        if (!runLatency(&cases[i], frames, &ns) || !runThroughput(&cases[i], frames, &fps)) {
+            return 1;
+        }
+        printf("%-12s %12.0f %14.0f\n", cases[i].name, ns, fps);
+    }
+    if (stackQueue.drops != 0 || peerQueue.drops != 0) {
+        printf("queue drops: %u to the stack, %u from it\n", stackQueue.drops, peerQueue.drops);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,110 @@
+#!/usr/bin/env python3
+"""Turns the output of the shell `trace` command into a readable timeline.
+
+Usage: trace_decode.py [FILE]   (reads stdin without FILE)
+
+Anything before the "trace" header line or after "end" is ignored, so a raw
+terminal capture can be fed in as is. Layout must match include/trace.h.
+"""
+
+import sys
+
+TRACE_VERSION = 1
+
+RX_FRAME, TX_FRAME, TCP_STATE, TIMER_FIRE, ARP_REQUEST, ARP_RESPONSE, DHCP_STATE, SOCKET_ERROR = range(1, 9)
+
+TCP_STATES = ["CLOSED", "LISTEN", "SYN_RECEIVED", "SYN_SENT", "ESTABLISHED", "FIN_WAIT_1",
+              "FIN_WAIT_2", "CLOSING", "CLOSE_WAIT", "LAST_ACK", "TIME_WAIT"]
+DHCP_STATES = ["DISABLED", "INIT", "SELECTING", "REQUESTING", "TESTING_IP", "BOUND",
+               "RENEWING", "REBINDING", "INITREBOOT", "REBOOTING"]
+SOCKET_ERRORS = ["NO_ERROR", "ARP_TIMEOUT", "TCP_SYN_ACK_TIMEOUT", "CONNECTION_RESET", "ARP_QUEUE_FULL"]
+TCP_FLAGS = ["FIN", "SYN", "RST", "PSH", "ACK"]
+PROTOCOLS = {1: "ICMP", 6: "TCP", 17: "UDP"}
+
+LENGTH_MASK = 0x07FF
+FLAGS_SHIFT = 11
+
+
+def name(table, value):
+    return table[value] if value < len(table) else str(value)
+
+
+def ip(value):
+    # first octet is in the low byte (convertIpAddressToU32)
+    return ".".join(str((value >> (8 * i)) & 0xFF) for i in range(4))
+
+
+def frame(kind, a, b, c, d, e):
+    length = b & LENGTH_MASK
+    if a == 0:
+        if c == 0x0806:
+            op = {1: "request", 2: "reply"}.get(d, "op %d" % d)
+            return "%s ARP %s %s len %d" % (kind, op, ip(e), length)
+        return "%s ethertype 0x%04X len %d" % (kind, c, length)
+    peer = "to" if kind == "TX" else "from"
+    text = "%s %s %s %s" % (kind, PROTOCOLS.get(a, "proto %d" % a), peer, ip(e))
+    if a in (6, 17):
+        text += " %d -> %d" % (c, d)
+    if a == 6:
+        flags = [f for i, f in enumerate(TCP_FLAGS) if (b >> (FLAGS_SHIFT + i)) & 1]
+        text += " [%s]" % ",".join(flags)
+    return text + " len %d" % length
+
+
+def describe(kind, a, b, c, d, e):
+    if kind == RX_FRAME:
+        return frame("RX", a, b, c, d, e)
+    if kind == TX_FRAME:
+        return frame("TX", a, b, c, d, e)
+    if kind == TCP_STATE:
+        return "TCP %d <-> %s:%d %s -> %s" % (b, ip(e), d, name(TCP_STATES, c), name(TCP_STATES, a))
+    if kind == TIMER_FIRE:
+        return "timer 0x%04X fired (callback 0x%08X)" % (b, e)
+    if kind == ARP_REQUEST:
+        return "ARP who-has %s" % ip(e)
+    if kind == ARP_RESPONSE:
+        return "ARP %s is-at (reply)" % ip(e)
+    if kind == DHCP_STATE:
+        return "DHCP %s -> %s" % (name(DHCP_STATES, c), name(DHCP_STATES, a))
+    if kind == SOCKET_ERROR:
+        return "socket %d <-> %s:%d error %s" % (b, ip(e), d, name(SOCKET_ERRORS, a))
+    return "unknown event %d a=%d b=%d c=%d d=%d e=0x%08X" % (kind, a, b, c, d, e)
+
+
+def decode(lines):
+    started = False
+    now = None
+    previous = None
+    for line in lines:
+        line = line.strip()
+        if not started:
+            fields = line.split()
+            if len(fields) == 5 and fields[0] == "trace":
+                version, count, total, now = (int(f) for f in fields[1:])
+                if version != TRACE_VERSION:
+                    sys.exit("trace version %d, decoder expects %d" % (version, TRACE_VERSION))
+                print("%d events (%d recorded, %d lost), dumped at %d ms"
+                      % (count, total, max(0, total - count), now))
+                started = True
+            continue
+        if line == "end":
+            break
+        if len(line) != 32:
+            continue
+        time = int(line[0:8], 16)
+        kind = int(line[8:10], 16)
+        a = int(line[10:12], 16)
+        b = int(line[12:16], 16)
+        c = int(line[16:20], 16)
+        d = int(line[20:24], 16)
+        e = int(line[24:32], 16)
+        delta = "" if previous is None else "+%d" % (time - previous)
+        previous = time
+        print("%10d ms %8s  %s" % (time, delta, describe(kind, a, b, c, d, e)))
+    if not started:
+        sys.exit("no trace header found")
+
+
+if __name__ == "__main__":
+    with (open(sys.argv[1]) if len(sys.argv) > 1 else sys.stdin) as f:
+        decode(f)